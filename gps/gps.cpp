@@ -1,5 +1,6 @@
 #include <cmath>
 #include <vector>
+#include <algorithm>
 
 #include <gps.h>
 
@@ -209,6 +210,143 @@ namespace gps {
 		return ! (gps::Coord(lat, lng) == p);
 	};
 
+	/**
+	 * Constructor for a local projection.
+	 * @param origin the point to be used as the center of the projection
+	 */
+	Projection::Projection (gps::Coord origin) : origin (origin) {
+		ky = R * M_PI / 180;
+		kx = ky * cos (rad (origin.lat));
+	};
+
+	/**
+	 * Project a point onto the plane.
+	 * @param p the point to project
+	 * @param x set to meters east of the origin
+	 * @param y set to meters north of the origin
+	 */
+	void Projection::project (const gps::Coord& p, double& x, double& y) const {
+		x = (p.lng - origin.lng) * kx;
+		y = (p.lat - origin.lat) * ky;
+	};
+
+	/**
+	 * Convert planar coordinates back to a GPS coordinate.
+	 * @param  x meters east of the origin
+	 * @param  y meters north of the origin
+	 * @return   the coordinate of the point
+	 */
+	gps::Coord Projection::unproject (double x, double y) const {
+		return gps::Coord (origin.lat + y / ky, origin.lng + x / kx);
+	};
+
+	/**
+	 * Build a grid over a path of coordinates.
+	 *
+	 * The path is projected about its first point.
+	 *
+	 * @param path the sequence of points making up the path
+	 * @param size the width of each cell, in meters
+	 */
+	Grid::Grid (const std::vector<gps::Coord>& path, double size) : size (size) {
+		if (path.size () == 0) return;
+		proj = gps::Projection (path[0]);
+		std::vector<double> x (path.size ()), y (path.size ());
+		for (unsigned i=0; i<path.size (); i++) proj.project (path[i], x[i], y[i]);
+		build (x, y);
+	};
+
+	/**
+	 * Build a grid over an already-projected path.
+	 * @param proj the projection used to compute x and y
+	 * @param x    meters east of the origin, for each point
+	 * @param y    meters north of the origin, for each point
+	 * @param size the width of each cell, in meters
+	 */
+	Grid::Grid (const gps::Projection& proj,
+				const std::vector<double>& x, const std::vector<double>& y,
+				double size) : proj (proj), size (size) {
+		build (x, y);
+	};
+
+	/**
+	 * Combine cell coordinates into a single sortable key.
+	 * @param  cx cell column
+	 * @param  cy cell row
+	 * @return    the cell's key
+	 */
+	uint64_t Grid::key (int cx, int cy) const {
+		return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+	};
+
+	/**
+	 * Add each leg of the path to the cells it covers.
+	 * @param x meters east of the origin, for each point
+	 * @param y meters north of the origin, for each point
+	 */
+	void Grid::build (const std::vector<double>& x, const std::vector<double>& y) {
+		if (x.size () == 0 || size <= 0) return;
+		unsigned nleg = x.size () > 1 ? x.size () - 1 : 1;
+
+		std::vector<std::pair<uint64_t, unsigned> > entries;
+		entries.reserve (nleg);
+		for (unsigned i=0; i<nleg; i++) {
+			unsigned j = std::min (i + 1, (unsigned)x.size () - 1);
+			int cx0 = floor (fmin (x[i], x[j]) / size), cx1 = floor (fmax (x[i], x[j]) / size);
+			int cy0 = floor (fmin (y[i], y[j]) / size), cy1 = floor (fmax (y[i], y[j]) / size);
+			for (int cx=cx0; cx<=cx1; cx++) {
+				for (int cy=cy0; cy<=cy1; cy++) entries.emplace_back (key (cx, cy), i);
+			}
+		}
+		std::sort (entries.begin (), entries.end ());
+
+		keys.resize (entries.size ());
+		items.resize (entries.size ());
+		for (unsigned i=0; i<entries.size (); i++) {
+			keys[i] = entries[i].first;
+			items[i] = entries[i].second;
+		}
+	};
+
+	/**
+	 * Find the legs that might pass within a given radius of a point.
+	 * @param p      the point
+	 * @param radius the search radius, in meters
+	 * @param legs   filled with the (sorted, unique) indexes of candidate legs;
+	 *               leg i joins points i and i+1
+	 */
+	void Grid::query (const gps::Coord& p, double radius, std::vector<unsigned>& legs) const {
+		double x, y;
+		proj.project (p, x, y);
+		query (x, y, radius, legs);
+	};
+
+	/**
+	 * Find the legs that might pass within a given radius of a projected point.
+	 * @param x      meters east of the origin
+	 * @param y      meters north of the origin
+	 * @param radius the search radius, in meters
+	 * @param legs   filled with the (sorted, unique) indexes of candidate legs
+	 */
+	void Grid::query (double x, double y, double radius, std::vector<unsigned>& legs) const {
+		legs.clear ();
+		if (keys.size () == 0) return;
+
+		int cx0 = floor ((x - radius) / size), cx1 = floor ((x + radius) / size);
+		int cy0 = floor ((y - radius) / size), cy1 = floor ((y + radius) / size);
+		for (int cx=cx0; cx<=cx1; cx++) {
+			for (int cy=cy0; cy<=cy1; cy++) {
+				uint64_t k = key (cx, cy);
+				auto it = std::lower_bound (keys.begin (), keys.end (), k);
+				for (; it != keys.end () && *it == k; it++) {
+					legs.push_back (items[it - keys.begin ()]);
+				}
+			}
+		}
+		std::sort (legs.begin (), legs.end ());
+		legs.erase (std::unique (legs.begin (), legs.end ()), legs.end ());
+	};
+
 	/**
 	 * Convert degrees to radians
 	 *
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <inttypes.h>
 
 /**
  * GPS Namespace for co-ordinate manipulation.
@@ -48,6 +49,64 @@ namespace gps {
 		bool operator!=(const Coord &p) const;
   	};
 
+	/**
+	 * A local Equirectangular projection about a fixed origin.
+	 *
+	 * This is the same projection as Coord::projectFlat (), but the
+	 * scale factors are computed once so that many points can be
+	 * projected (and un-projected) cheaply, without any allocation.
+	 * Planar coordinates are meters east (x) and north (y) of the origin.
+	 */
+	class Projection {
+	private:
+		gps::Coord origin; /*!< the center of the projection */
+		double kx = 0.0;   /*!< meters per degree of longitude at the origin */
+		double ky = 0.0;   /*!< meters per degree of latitude */
+
+	public:
+		Projection () {};
+		Projection (gps::Coord origin);
+
+		/** @return the origin of the projection */
+		const gps::Coord& get_origin (void) const { return origin; };
+
+		void project (const gps::Coord& p, double& x, double& y) const;
+		gps::Coord unproject (double x, double y) const;
+	};
+
+	/**
+	 * A uniform grid spatial index over the legs of a path.
+	 *
+	 * Each leg (the line between two consecutive points) is added to every
+	 * cell its bounding box covers. Only occupied cells are stored, as sorted
+	 * cell keys, so finding the candidate legs near a point
+	 * is a binary search per cell rather than a scan of the whole path.
+	 * Candidates still need an exact distance check by the caller.
+	 */
+	class Grid {
+	private:
+		gps::Projection proj;         /*!< projection used to place points in cells */
+		double size = 0.0;            /*!< width of each (square) cell, in meters */
+		std::vector<uint64_t> keys;   /*!< sorted cell key of each entry */
+		std::vector<unsigned> items;  /*!< leg index of each entry */
+
+		uint64_t key (int cx, int cy) const;
+		void build (const std::vector<double>& x, const std::vector<double>& y);
+
+	public:
+		Grid () {};
+		Grid (const std::vector<gps::Coord>& path, double size);
+		Grid (const gps::Projection& proj,
+			  const std::vector<double>& x, const std::vector<double>& y,
+			  double size);
+
+		/** @return the projection used by the grid */
+		const gps::Projection& get_projection (void) const { return proj; };
+
+		void query (const gps::Coord& p, double radius, std::vector<unsigned>& legs) const;
+		void query (double x, double y, double radius, std::vector<unsigned>& legs) const;
+	};
+
 	double rad(double d);
 	double deg(double r);
 
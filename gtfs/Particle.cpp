@@ -3,6 +3,8 @@
 #include <fstream>
 #include <vector>
 #include <math.h>
+#include <limits>
+#include <algorithm>
 
 #include "gtfs.h"
 
@@ -14,7 +16,8 @@ namespace gtfs {
 	*
 	* @param v the vehicle object pointer to which the particle belongs
 	*/
-	Particle::Particle (Vehicle* v) : id (v->allocate_id ()), vehicle (v) {
+	Particle::Particle (Vehicle* v) :
+	id (v->allocate_id ()), trajectory (v->window), vehicle (v) {
 
 		// auto t = v->get_trip ();
 		// if (!t) return;
@@ -39,22 +42,90 @@ namespace gtfs {
 	 *
 	 * @param p the parent particle to be copied
 	 */
-	Particle::Particle (const Particle &p) {
-		start = p.get_start () + p.get_latest (); // p.get_start ();
-		latest = 0; // -- start from the end of the trajectory - the other stuff doesn't matter!! p.get_latest ();
-		// for (int k=0; k<=latest; k++) trajectory.push_back (p.get_distance (k));
+	Particle::Particle (const Particle &p) : trajectory (p.trajectory.get_window ()) {
+		vehicle = p.vehicle;
+		assign (p);
+	};
+
+	/**
+	 * Turn this particle into a copy of another (see the copy constructor),
+	 * reusing its existing storage.
+	 *
+	 * Only the state needed to continue from the parent's latest position
+	 * is copied; the trajectory is restarted from that point.
+	 *
+	 * @param p the parent particle to be copied
+	 */
+	void Particle::assign (const Particle &p) {
+		assign (p, p.vehicle->allocate_id ());
+	};
+
+	/**
+	 * Turn this particle into a copy of another, with a given ID.
+	 *
+	 * @param p   the parent particle to be copied
+	 * @param pid the new particle's ID, allocated by the vehicle
+	 */
+	void Particle::assign (const Particle &p, unsigned long pid) {
+		id = pid;
+		start = p.start + p.latest;
+		latest = 0; // -- start from the end of the trajectory - the other stuff doesn't matter!!
+		trajectory.clear ();
 		trajectory.push_back (p.get_distance ());
 		velocity = p.get_velocity ();
-		stop_times = p.get_stop_times ();
-		travel_times = p.get_travel_times ();
+		vmean = p.vmean;
+		vvar = p.vvar;
+		tmove = 0;
+		dvar = 0.0;
+		proj_distance = p.proj_distance;
+		std::copy (p.proj, p.proj + 4, proj);
+		stop_times = p.stop_times;
+		travel_times = p.travel_times;
+		etas.clear ();
+		eta_cert.clear ();
+		finished = false;
 		log_likelihood = 0;
 
 		// Copy vehicle pointer
 		vehicle = p.vehicle;
 		parent_id = p.id;
+	};
+
+	/**
+	 * Return the particle to its newly-constructed state, with a new ID,
+	 * but keep the memory it has allocated so it can be reused.
+	 */
+	void Particle::reset (void) {
+		id = vehicle->allocate_id ();
+		parent_id.reset ();
+		start = 0;
+		latest = 0;
+		trajectory.clear ();
+		stop_times.clear ();
+		travel_times.clear ();
+		etas.clear ();
+		eta_cert.clear ();
+		finished = false;
+		velocity = 0.0;
+		vmean = 0.0;
+		vvar = 0.0;
+		tmove = 0;
+		dvar = 0.0;
+		proj_distance = -1.0;
+		log_likelihood = 0.0;
+	};
 
-		// Increment particle id
-		id = p.vehicle->allocate_id ();
+	/**
+	 * Reserve space for the stop and travel times along a route.
+	 * @param stops    the number of stops
+	 * @param segments the number of segments
+	 */
+	void Particle::reserve (unsigned stops, unsigned segments) {
+		// initialize creates two entries per stop
+		stop_times.reserve (2 * stops);
+		travel_times.reserve (segments);
+		etas.reserve (stops);
+		eta_cert.reserve (stops);
 	};
 
 	/**
@@ -97,9 +168,9 @@ namespace gtfs {
 		return latest;
 	};
 
-	/** @return the particle's trajectory */
+	/** @return the particle's (retained) trajectory */
 	std::vector<double> Particle::get_trajectory (void) const {
-		return trajectory;
+		return trajectory.get_values ();
 	};
 
 	/** @return   the distance into trip (meters) */
@@ -115,6 +186,11 @@ namespace gtfs {
 	/** @return distance at time start+k */
 	double Particle::get_distance (unsigned k) const {
 		if (trajectory.size () == 0) return 0.0;
+		if (k < trajectory.get_first ()) {
+			std::clog << "\n *** NOTE: requesting " << k << ", but history starts at "
+				<< trajectory.get_first ();
+			return trajectory[trajectory.get_first ()];
+		}
 		if (k < trajectory.size ()) return trajectory[k];
 		std::clog << "\n *** NOTE: requesting " << k << " of " << trajectory.size ();
 		return (trajectory.back ());
@@ -123,7 +199,8 @@ namespace gtfs {
 	/**@return   the velocity (meters per second) */
 	double Particle::get_velocity (void) const {
 		// begining/end of trip, velocity is 0
-		if (get_latest () < 1 || (int)trajectory.size () <= get_latest ()) return velocity;
+		if (get_latest () < 1 || (int)trajectory.size () <= get_latest () ||
+			get_latest () <= (int)trajectory.get_first ()) return velocity;
 		return trajectory[get_latest ()] - trajectory[get_latest () - 1];
 	};
 
@@ -177,6 +254,12 @@ namespace gtfs {
 		stop_times.resize (st.size ());
 		for (unsigned i=0; i<st.size (); i++) stop_times.emplace_back (0, 0);
 		velocity = 0;
+		if (vehicle->rao_blackwell) {
+			vmean = 10.0;
+			vvar = 144.0;
+			int e = r->find_event (dist);
+			set_speed_prior (sg[e > 0 ? r->get_events ()[e-1].segment : 0]);
+		}
 		int wait = 0 ; //(sampling::exponential (1.0 / 20.0).rand (rng));
 		double dx = dist;
 		if (dist == 0.0) {
@@ -219,6 +302,9 @@ namespace gtfs {
 		// while (latest < trajectory.size () && trajectory[latest] <= dist) latest++;
 		latest = trajectory.size () - 1;
 		start = vehicle->get_timestamp () - latest;
+		// the position was drawn directly, not from the speed
+		tmove = 0;
+		dvar = 0.0;
 
 		// std::clog << "\n -> CURRENT = " << latest << " = " << trajectory[latest]
 		// 	<< " -> get_distance () = " << get_distance ();
@@ -256,12 +342,13 @@ namespace gtfs {
 		if (!trip) return;
 		auto route = trip->get_route ();
 		if (!route) return;
-		auto stops = route->get_stops ();
+		auto& stops = route->get_stops ();
 		if (stops.size () == 0) return;
 		auto shape = route->get_shape ();
 		if (!shape) return;
-		auto segments = shape->get_segments ();
+		auto& segments = shape->get_segments ();
 		if (segments.size () == 0) return;
+		auto& events = route->get_events ();
 
 		// trip trajectory
 		if (latest >= 0 && (int)trajectory.size () - 1 > get_latest ()) {
@@ -269,6 +356,8 @@ namespace gtfs {
 			trajectory.resize (get_latest () + 1);
 			// std::clog << " to " << trajectory.size ();
 		}
+		// the distance (and velocity) at the observation are needed exactly
+		if (start > 0) trajectory.keep (vehicle->get_timestamp () - start);
 
 		// create trajectories
 		double Dmax ( stops.back ().shape_dist_traveled );
@@ -277,63 +366,91 @@ namespace gtfs {
 		double sigmav (12.0);
 		double amin (-5.0);
 		double Vmax (30.0);
-		double pi (0.5);
-		double gamma (3.0);
-		double tau (6.0);
-		auto rtau = sampling::exponential (1 / tau);
-		double rho (0.3);
-		double theta (15);
-		auto rtheta = sampling::exponential (1 / theta);
+		double qv (1.0); // Rao-Blackwellised: speed variance added per second
+
+		tmove = 0;
+		dvar = 0.0;
 
 		double d (get_distance ()), v (get_velocity ());
 		int J (stops.size ());    // the number of stops
 		int L (segments.size ()); // the number of segments
+		int E (events.size ());   // the number of stops + intersections
 
-        int j = 0, l = 0;
-		// quickly find which segment the start location is in
-		while (j < J-1 && d > stops[j+1].shape_dist_traveled) j++;
-		while (l < L-1 && d > segments[l+1].shape_dist_traveled) l++;
+		// find the next stop/intersection, and the current stop and segment
+		int e = route->find_event (d);
+		int j = e > 0 ? events[e-1].stop : 0, l = e > 0 ? events[e-1].segment : 0;
 
         // so stop[j] = THE CURRENT STOP (i.e., most recently visited)
-        //    stop[j+1] = THE NEXT (upcoming) STOP
         // and seg[l] = THE CURRENT SEGMENT INDEX
-        //     seg[l+1] = THE NEXT INTERSECTION/SEGMENT ...
+        // and events[e] = THE NEXT (upcoming) STOP OR INTERSECTION
 
         // std::clog << " > on stop " << j << " of " << J << " and segment " << l << " of " << L << "...";
 
         if (d == 0) travel_times[0].initialized = true;
 
+        // the time horizon: seconds until the trajectory reaches 60 seconds
+        // past the latest observation (unlimited while initializing)
+        int64_t tend = (int64_t)vehicle->get_timestamp () + 60;
+        auto remaining = [&] () -> int64_t {
+            if (latest == -1) return std::numeric_limits<int64_t>::max ();
+            return tend - (int64_t)(start + trajectory.size ());
+        };
+        // of the next k seconds, how many finish before the latest observation?
+        auto observed = [&] (int64_t k) -> int64_t {
+            if (start == 0) return k;
+            int64_t n = (int64_t)vehicle->get_timestamp () - (int64_t)(start + trajectory.size ()) - 1;
+            return std::max ((int64_t)0, std::min (n, k));
+        };
+        const double lpwait = log (0.9); // log P(waiting particle stays put another second)
+
+		// the bus hasn't moved (e.g., dwelling or on layover): hold the particle
+		// where it is until the observation in one step; when it departs
+		// is drawn once, below, as for any stopped particle
+		bool stationary = start > 0 && vehicle->is_stationary ();
+		if (stationary && d < Dmax && e < E) {
+			int64_t k = (int64_t)vehicle->get_timestamp () - (int64_t)(start + trajectory.size ()) + 1;
+			if (k > 0) {
+				if (d != stops[j].shape_dist_traveled &&
+					d != segments[l].shape_dist_traveled &&
+					travel_times[l].initialized && !travel_times[l].complete)
+					travel_times[l].time += observed (k);
+				trajectory.push_back (d, k);
+				if (d == stops[j].shape_dist_traveled)
+					std::get<1> (stop_times[j]) += k;
+			}
+			v = 0;
+			velocity = 0;
+		}
+
         double dmax;
 		int pstops (-1); // does the particle stop at the next stop/intersection?
-		while (d < Dmax &&
-			   (latest == -1 || start + trajectory.size () < vehicle->get_timestamp () + 60)) {
-
-			// initial wait time
-			if (v == 0 || vehicle->get_dmaxtraveled () >= 0) {
-				if (rng.runif () < 0.9) {
-					trajectory.push_back (d);
-					if (d == stops[j].shape_dist_traveled)
-						std::get<1> (stop_times[j])++;
-
-					if (d != stops[j].shape_dist_traveled &&
-						d != segments[l].shape_dist_traveled &&
-						travel_times[l].initialized && !travel_times[l].complete &&
-                        (start == 0 || start + trajectory.size () < vehicle->get_timestamp ()))
-						travel_times[l].time++;
-					continue;
-				}
+		bool departed (false); // while the bus is stationary, a held particle waits once, then moves off
+		while (d < Dmax && e < E && remaining () > 0) {
+
+			// initial wait time: each second, the particle stays put with probability 0.9;
+			// draw the number of seconds until it moves (geometric) in one go
+			if ((v == 0 && !departed) || (!stationary && vehicle->get_dmaxtraveled () >= 0)) {
+				if (stationary) departed = true;
+				int64_t k = floor (log (rng.runif ()) / lpwait);
+				bool timeout = k >= remaining ();
+				if (timeout) k = remaining ();
+
+				if (d != stops[j].shape_dist_traveled &&
+					d != segments[l].shape_dist_traveled &&
+					travel_times[l].initialized && !travel_times[l].complete)
+					travel_times[l].time += observed (k);
+				trajectory.push_back (d, k);
+				if (d == stops[j].shape_dist_traveled)
+					std::get<1> (stop_times[j]) += k;
+
+				if (timeout) break;
 			}
 
 
-			// figure out dmax at the start of each step
-            // it's either the NEXT stop, or the NEXT intersection
-			if (l < L-1 && segments[l+1].shape_dist_traveled < stops[j+1].shape_dist_traveled) {
-				dmax = segments[l+1].shape_dist_traveled;
-				if (pstops == -1) pstops = rng.runif () < rho;
-			} else {
-				dmax = stops[j+1].shape_dist_traveled;
-				if (pstops == -1) pstops = rng.runif () < pi;
-			}
+			// dmax is the NEXT stop or intersection, whichever comes first
+			auto& next = events[e];
+			dmax = next.distance;
+			if (pstops == -1) pstops = rng.runif () < next.pstop;
 			double vmax = Vmax, vmin = 2;
 			if (pstops) {
 				// if particle going to stop, then restricted by either
@@ -343,15 +460,25 @@ namespace gtfs {
 				vmin = 0;
 			}
 
-			auto rnorm = sampling::normal (0, sigmav);
-			velocity = v + rnorm.rand (rng);
-			int nattempt = 0;
-			while (velocity < vmin || velocity > vmax) {
-				if (nattempt > 20) {
-					velocity = sampling::uniform (vmin, vmax).rand (rng);
+			if (vehicle->rao_blackwell) {
+				// travel at the mean speed; the uncertainty is carried by (vmean, vvar)
+				// and accounted for in the likelihood
+				int64_t o = observed (1);
+				tmove += o;
+				vvar = fmin (vvar + qv * o, sigmav * sigmav);
+				velocity = fmin (fmax (vmean, vmin), vmax);
+			} else {
+				// propose from N(v, sigmav^2) restricted to [vmin, vmax] using one draw;
+				// as before, keep the current speed (if it's allowed) as often as
+				// an unrestricted proposal would fall outside the range
+				sampling::truncated_normal vdist (v, sigmav, vmin, vmax);
+				double u = rng.runif ();
+				if (v < vmin || v > vmax) {
+					velocity = vdist.quantile (u);
+				} else if (u < vdist.get_mass ()) {
+					velocity = vdist.quantile (u / vdist.get_mass ());
 				} else {
-					velocity = v + rnorm.rand (rng) * nattempt / 10;
-					nattempt++;
+					velocity = v;
 				}
 			}
 
@@ -359,46 +486,52 @@ namespace gtfs {
 
 			if (d >= dmax) {
 				d = dmax;
+                if (travel_times[l].initialized && !travel_times[l].complete)
+                    travel_times[l].time += observed (1);
                 trajectory.push_back (d);
-                if (travel_times[l].initialized && !travel_times[l].complete &&
-                    (start == 0 || start + trajectory.size () < vehicle->get_timestamp ()))
-                    travel_times[l].time++;
 
-				if (pstops == 1) v = 0; // only 0 if particle decides to stop
+				if (pstops == 1) {
+					v = 0; // only 0 if particle decides to stop
+					departed = false;
+				}
 
 				int wait = 0;
-				if (dmax == stops[j+1].shape_dist_traveled) {
-					// stopping at NEXT BUS STOP (j+1)
-					j++;
+				if (next.is_stop ()) {
+					// stopping at NEXT BUS STOP
+					j = next.stop;
 					std::get<0> (stop_times[j]) = trajectory.size ();
 					if (j == J-1) break;
 
-					wait += pstops * (gamma + rtau.rand (rng));
+					wait += pstops * (next.wait_min + sampling::exponential (1 / next.wait_mean).rand (rng));
 					std::get<1> (stop_times[j]) = wait;
 				} else {
-					// stopping at NEXT INTERSECTION (l+1)
-                    if (travel_times[l].initialized && 
+					// stopping at NEXT INTERSECTION
+                    if (travel_times[l].initialized &&
                         (start == 0 || start + trajectory.size () < vehicle->get_timestamp ())) {
                         travel_times[l].complete = true;
                     }
-                    l++;
+                    l = next.segment;
                     if (l == L-1) break;
+                    if (vehicle->rao_blackwell &&
+                        (start == 0 || start + trajectory.size () < vehicle->get_timestamp ())) {
+                        // speeds in different segments are independent
+                        dvar += (double)tmove * tmove * vvar;
+                        tmove = 0;
+                        set_speed_prior (segments[l]);
+                    }
                         
-					wait += pstops * rtheta.rand (rng);
+					wait += pstops * (next.wait_min + sampling::exponential (1 / next.wait_mean).rand (rng));
                     if (start == 0 || start + trajectory.size () < vehicle->get_timestamp ())
     					travel_times[l].initialized = true;
 				}
-				while (wait > 0 &&
-				 	   (latest == -1 || start + trajectory.size () < vehicle->get_timestamp () + 60)) {
-					trajectory.push_back (d);
-					wait--;
-				}
+				e++;
+				// the whole dwell/queue, up to the horizon
+				trajectory.push_back (d, std::max ((int64_t)0, std::min ((int64_t)wait, remaining ())));
 				pstops = -1;
 			} else {
+    			if (travel_times[l].initialized && !travel_times[l].complete)
+    				travel_times[l].time += observed (1);
     			trajectory.push_back (d);
-    			if (travel_times[l].initialized && !travel_times[l].complete &&
-                    (start == 0 || start + trajectory.size () < vehicle->get_timestamp ()))
-    				travel_times[l].time++;
             }
 		}
 
@@ -415,6 +548,80 @@ namespace gtfs {
 	};
 
 
+	/**
+	 * Set the particle's speed distribution to the prior for a segment
+	 * (Rao-Blackwellised mode), from the segment's travel time estimate:
+	 * speed = length / travel time, with variance by the delta method.
+	 * Segments without an estimate keep the particle's current speed.
+	 *
+	 * @param segment the segment being entered
+	 */
+	void Particle::set_speed_prior (const ShapeSegment& segment) {
+		double sigmav (12.0);
+		auto& sg = segment.segment;
+		if (!sg || sg->get_timestamp () == 0) return;
+		double len = sg->get_length (), tt = sg->get_travel_time ();
+		if (len <= 0 || tt <= 0) return;
+		vmean = len / tt;
+		vvar = fmin (pow (len / pow (tt, 2), 2) * sg->get_travel_time_var (), sigmav * sigmav);
+	};
+
+	/**
+	 * Kalman filter update of the particle's speed, given how far along the
+	 * route the reported position is from the particle (Rao-Blackwellised mode).
+	 *
+	 * The particle traveled for `tmove` seconds at its (unknown) speed in the
+	 * current segment, so its distance and speed are correlated; both are updated,
+	 * but the distance is kept between the previous and next stop/intersection,
+	 * so the arrival times already recorded remain valid.
+	 *
+	 * @param r the along-track offset of the reported position (meters)
+	 * @param R the GPS error variance (m^2)
+	 */
+	void Particle::update_speed (double r, double R) {
+		if (!has_position ()) return;
+		double S = R + get_position_var ();
+		double cv = tmove * vvar; // Cov (distance, speed)
+		vmean += cv / S * r;
+		vvar -= cv * cv / S;
+
+		double d = get_distance ();
+		double dnew = d + get_position_var () / S * r;
+		auto route = vehicle->get_trip ()->get_route ();
+		auto& events = route->get_events ();
+		int e = route->find_event (d);
+		if (e == (int)events.size () || d == events[e].distance) return; // waiting at a stop or intersection
+		dnew = fmin (dnew, events[e].distance);
+		if (e > 0) dnew = fmax (dnew, nextafter (events[e-1].distance, INFINITY));
+		trajectory.set (latest, dnew);
+	};
+
+	/**
+	 * The particle's planar position and direction of travel at the latest observation.
+	 *
+	 * The result is kept with the particle (and its copies),
+	 * so particles that have not moved (e.g., waiting at a stop)
+	 * do not need the shape to be searched again.
+	 *
+	 * @param index the index of the route's shape
+	 * @param x     set to meters east of the shape's origin
+	 * @param y     set to meters north of the shape's origin
+	 * @param tx    set to the east component of the unit direction of travel
+	 * @param ty    set to the north component of the unit direction of travel
+	 */
+	void Particle::project (const ShapeIndex& index, double& x, double& y, double& tx, double& ty) {
+		double d = get_distance ();
+		if (d != proj_distance) {
+			index.project (d, proj[0], proj[1], proj[2], proj[3]);
+			proj_distance = d;
+		}
+		x = proj[0];
+		y = proj[1];
+		tx = proj[2];
+		ty = proj[3];
+	};
+
+
 	/**
 	 * Compute the likelihood of the particle
 	 * given the bus's reported location
@@ -468,11 +675,14 @@ namespace gtfs {
 		}
 
 		if (get_latest () >= 0 && get_latest () < (int)trajectory.size ()) {
-			gps::Coord x = get_coords ( get_distance (), shape );
-			std::vector<double> z (x.projectFlat(vehicle->get_position ()));
+			// compare particle and vehicle positions on the shape's local plane
+			auto& index = shape->get_index ();
+			double px, py, vx, vy;
+			index.project (get_distance (), px, py);
+			index.get_projection ().project (vehicle->get_position (), vx, vy);
 
 			nllhood += log (2 * M_PI * sigy);
-			nllhood += (pow(z[0], 2) + pow(z[1], 2)) / (2 * pow(sigy, 2));
+			nllhood += (pow(px - vx, 2) + pow(py - vy, 2)) / (2 * pow(sigy, 2));
 
 			if (use_segments) {
 				// Use network state to filter particles even further ... 
@@ -576,128 +786,90 @@ namespace gtfs {
 
 	/**
 	 * Calculate the expected time until arrival (ETA) for each future stop
-	 * along the route.
+	 * along the route, drawing the particle's own segment speeds.
 	 */
 	void Particle::calculate_etas (sampling::RNG& rng) {
-		// if (etas.size () > 0) {
-		// 	std::cerr << "Particle already has ETAs; something went wrong!\n";
-		// 	return;
-		// }
-		
 		etas.clear ();
 		if (finished) return;
-		
+
 		if (!vehicle->get_trip () || !vehicle->get_trip ()->get_route () ||
 			vehicle->get_trip ()->get_route ()->get_stops ().size () == 0) {
 			std::cerr << "Particle's vehicle doesn't has trip/route/stops. Cannot predict!\n";
 			return;
 		}
-		// Seems OK - lets go!
 		auto route = vehicle->get_trip ()->get_route ();
-		if (!route) return;
-		auto stops = route->get_stops ();
+		auto& stops = route->get_stops ();
 		if (stops.size () == 0 || stops.back ().shape_dist_traveled == 0) return;
 		auto shape = route->get_shape ();
 		if (!shape) return;
-		auto segments = shape->get_segments ();
+		auto& segments = shape->get_segments ();
 		if (segments.size () == 0 || segments.back ().shape_dist_traveled == 0) return;
+		auto& events = route->get_events ();
+
+		int e = route->find_event (get_distance ());
+		int l = e > 0 ? events[e-1].segment : 0;
+		SegmentSpeeds speeds;
+		speeds.draw (*route, l, 1, rng);
+		calculate_etas (speeds, 0);
+	};
+
+	/**
+	 * Calculate the expected time until arrival (ETA) for each future stop
+	 * along the route, using speeds drawn for the vehicle.
+	 *
+	 * Only the stops the particle has not yet passed are given an ETA;
+	 * the others are 0.
+	 *
+	 * @param speeds segment speeds, drawn (at least) from the particle's segment
+	 * @param r      the set of speeds to use
+	 */
+	void Particle::calculate_etas (const SegmentSpeeds& speeds, unsigned r) {
+		etas.clear ();
+		if (finished) return;
+
+		auto route = vehicle->get_trip ()->get_route ();
+		auto& stops = route->get_stops ();
+		auto& segments = route->get_shape ()->get_segments ();
+		auto& events = route->get_events ();
 
 		double distance = get_distance ();
-		double vel = get_velocity ();
 		int J (stops.size ());    // the number of stops
-		int L (segments.size ()); // the number of segments
-        int j, l = 0;
-        while (l < L-1 && distance > segments[l+1].shape_dist_traveled) l++;
-
-		std::vector<double> seglens (L, 0);
-		std::vector<double> segspeeds (L, 0);
-		std::vector<double> segcert (L, 0);
-		// std::clog << "\n *** Segments: [" << L << "]";
-		for (int i=l; i<L; i++) {
-			double len;
-			if (segments[i].segment->get_length () > 0) {
-				len = segments[i].segment->get_length ();
-			} else if (i < L-1) {
-				len = segments[i+1].shape_dist_traveled - segments[i].shape_dist_traveled;
-			} else {
-				len = stops.back ().shape_dist_traveled - segments[i].shape_dist_traveled;
-			}
+		int E (events.size ());   // the number of stops + intersections
+		int e = route->find_event (distance);
+		int l = e > 0 ? events[e-1].segment : 0;
 
-			if (segments[i].segment && 
-				segments[i].segment->get_timestamp () > 0) {
-				vel = 0;
-				int natt = 0;
-				double trtime;
-				segcert[i] = 1;
-				while (vel <= 0 || vel > 30) {
-					trtime = rng.rnorm () * segments[i].segment->get_travel_time_var () + 
-						segments[i].segment->get_travel_time ();
-					vel = len / trtime;
-					natt++;
-					if (natt == 20) {
-						vel = 12;
-						segcert[i] = 0;
-					}
-				}
-			} else {
-				vel = 0; //get_velocity ();
-				while (vel <= 0 || vel > 30) {
-					vel = rng.rnorm () * 5 + 15;
-				}
-			}
-			seglens[i] = len;
-			segspeeds[i] = vel;
-			// std::clog << "\n [" << l << "]: " << len << "m long, "
-				// << vel << "m/s";
-		}
-		
 		// only M-1 stops to predict (can't do the first one)
-		etas.resize (stops.size (), 0);
-
-		vel = segspeeds[l];
-		// std::clog << "\n * ETAs for " << etas.size () << " stops... " 
-		// 	<< vel << "m/s:";
+		etas.resize (J, 0);
 
+		double vel = speeds.get_speed (r, l);
 		// std::clog << "\n * On segment " << l+1 << " of " << L
 			// << ", traveling " << vel << "m/s: \n >>>";
 
 		int tt = 0; // travel time up to last intersection
-		eta_cert.resize (J);
-		for (j=0; j<J; j++) {
-			eta_cert[j] = 0;
-			if (stops[j].shape_dist_traveled <= distance) continue;
-
-			// If the next stop is farther than the next intersection ...
-			while (l < L-1 && stops[j].shape_dist_traveled > segments[l+1].shape_dist_traveled) {
-				// creep forward ...
-				l++;
+		eta_cert.assign (J, 0);
+		for (; e<E; e++) {
+			auto& ev = events[e];
+			if (!ev.is_stop ()) {
+				// creep forward through the intersection ...
+				l = ev.segment;
 				if (segments[l-1].shape_dist_traveled < distance) {
 					tt = (segments[l].shape_dist_traveled - distance) / vel;
 				} else {
-					tt += seglens[l-1] / vel;
+					tt += speeds.length[l-1] / vel;
 				}
-				vel = segspeeds[l];
-				// std::clog << " {{ INTERSECTION -- ETA: " 
-					// << tt << "; speed: " << vel << " }} >> ";
+				vel = speeds.get_speed (r, l);
+				continue;
 			}
+			if (ev.distance <= distance) continue;
 
 			double deltad;
 			if (segments[l].shape_dist_traveled < distance) {
-				deltad = stops[j].shape_dist_traveled - distance;
+				deltad = ev.distance - distance;
 			} else {
-				deltad = stops[j].shape_dist_traveled - segments[l].shape_dist_traveled;
+				deltad = ev.distance - segments[l].shape_dist_traveled;
 			}
-			etas[j] = vehicle->get_timestamp () + tt + round(deltad / vel);;
-			eta_cert[j] = segcert[l];
-			// std::clog << " [" << j << ", " << deltad << "m away, "
-				// << round(deltad / vel) << "s from int, ETA: " << etas[j] << "] >> ";
-
-			// std::clog << "\n [" << j+1 << "/" << J << ", "
-			// 	<< stops[j].shape_dist_traveled << "m]: "
-			// 	// << (stops[j].shape_dist_traveled - distance) << "m away - "
-			// 	<< tt << " + " << round(deltad / vel) << "s + "
-			// 	<< vehicle->get_timestamp () << " = "
-			// 	<< etas[j];
+			etas[ev.stop] = vehicle->get_timestamp () + tt + round(deltad / vel);
+			eta_cert[ev.stop] = speeds.get_cert (r, l);
 		}
 	};
 
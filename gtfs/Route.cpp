@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 
 #include <gtfs.h>
 
@@ -43,6 +44,18 @@ namespace gtfs {
 		return shape;
 	};
 
+	/**
+	 * Find the next event at or beyond a given distance.
+	 * @param  distance distance along the route
+	 * @return          index of the first event with event.distance >= distance
+	 *                  (the number of events, if there are none)
+	 */
+	unsigned Route::find_event (double distance) const {
+		auto it = std::lower_bound (events.begin (), events.end (), distance,
+			[](const RouteEvent& e, double d) { return e.distance < d; });
+		return it - events.begin ();
+	};
+
 
 	// --- SETTERS
 
@@ -55,4 +68,56 @@ namespace gtfs {
 	};
 
 
+	// --- METHODS
+
+	/**
+	 * Merge the route's stops and the shape's intersections
+	 * into a single table ordered by distance.
+	 *
+	 * Where a stop and an intersection are at the same distance,
+	 * the stop comes first.
+	 */
+	void Route::build_events (void) {
+		events.clear ();
+		if (!shape || stops.size () == 0) return;
+		auto& segments = shape->get_segments ();
+
+		// Stopping parameters (not yet estimated for individual stops/intersections):
+		// - stops: P(stop) = pi, dwell time = gamma + Exp(mean = tau)
+		// - intersections: P(stop) = rho, queue time = Exp(mean = theta)
+		double pi (0.5), gamma (3.0), tau (6.0);
+		double rho (0.3), theta (15.0);
+
+		events.reserve (stops.size () + segments.size ());
+		for (unsigned j=1; j<stops.size (); j++) {
+			events.emplace_back (stops[j].shape_dist_traveled, 0, j);
+			events.back ().pstop = pi;
+			events.back ().wait_min = gamma;
+			events.back ().wait_mean = tau;
+		}
+		for (unsigned l=1; l<segments.size (); l++) {
+			events.emplace_back (segments[l].shape_dist_traveled, 1, l);
+			events.back ().pstop = rho;
+			events.back ().wait_mean = theta;
+		}
+		std::stable_sort (events.begin (), events.end (),
+			[](const RouteEvent& a, const RouteEvent& b) {
+				return a.distance < b.distance ||
+					(a.distance == b.distance && a.type < b.type);
+			});
+
+		// fill in the stop/segment the vehicle is on after each event
+		unsigned j = 0, l = 0;
+		for (auto& e: events) {
+			if (e.is_stop ()) {
+				j = e.stop;
+				e.segment = l;
+			} else {
+				l = e.segment;
+				e.stop = j;
+			}
+		}
+	};
+
+
 };
@@ -0,0 +1,147 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+
+#include <gtfs.h>
+
+namespace gtfs {
+
+	// --- METHODS
+
+	/**
+	 * Bring the travel times up to date with the segments' estimates,
+	 * recomputing only the segments whose estimates have changed.
+	 *
+	 * @param  route the vehicle's route
+	 * @return       true if anything changed
+	 */
+	bool RouteTimes::update (Route& route) {
+		auto& stops = route.get_stops ();
+		auto& segments = route.get_shape ()->get_segments ();
+		auto& events = route.get_events ();
+		unsigned L (segments.size ()), E (events.size ());
+		bool changed = false;
+		if (start.size () != L + 1 || event.size () != E) {
+			start.assign (L + 1, 0.0);
+			mean.assign (L, 0.0);
+			var.assign (L, 0.0);
+			cmean.assign (L + 1, 0.0);
+			cvar.assign (L + 1, 0.0);
+			cert.assign (L, 0);
+			version.assign (L, 0);
+
+			// the time spent at stops and intersections doesn't change:
+			// W = pstop * (wait_min + X), X ~ Exp(mean wait_mean)
+			event.resize (E);
+			wmean.assign (E + 1, 0.0);
+			wvar.assign (E + 1, 0.0);
+			for (unsigned i=0; i<E; i++) {
+				auto& ev = events[i];
+				double w = ev.wait_min + ev.wait_mean;
+				double m = ev.pstop * w;
+				event[i] = ev.distance;
+				wmean[i+1] = wmean[i] + m;
+				wvar[i+1] = wvar[i] + ev.pstop * (w * w + ev.wait_mean * ev.wait_mean) - m * m;
+			}
+			changed = true;
+		}
+
+		for (unsigned l=0; l<L; l++) start[l] = segments[l].shape_dist_traveled;
+		start[L] = stops.back ().shape_dist_traveled;
+
+		for (unsigned l=0; l<L; l++) {
+			auto& sg = segments[l].segment;
+			if (!changed && sg && version[l] == sg->get_version ()) continue;
+			changed = true;
+			double len = sg && sg->get_length () > 0 ? sg->get_length () : start[l+1] - start[l];
+			if (sg && sg->get_timestamp () > 0) {
+				mean[l] = sg->get_travel_time ();
+				var[l] = sg->get_travel_time_var ();
+				cert[l] = 1;
+			} else {
+				// speed 15 +/- 5 m/s; variance by the delta method
+				mean[l] = len / 15;
+				var[l] = pow (len / 225, 2) * 25;
+				cert[l] = 0;
+			}
+			version[l] = sg ? sg->get_version () : 0;
+		}
+		if (!changed) return false;
+
+		for (unsigned l=0; l<L; l++) {
+			cmean[l+1] = cmean[l] + mean[l];
+			cvar[l+1] = cvar[l] + var[l];
+		}
+		return true;
+	};
+
+	/**
+	 * Discard everything (e.g., when the vehicle starts a new trip).
+	 */
+	void RouteTimes::clear (void) {
+		start.clear ();
+		mean.clear ();
+		var.clear ();
+		cmean.clear ();
+		cvar.clear ();
+		cert.clear ();
+		version.clear ();
+		event.clear ();
+		wmean.clear ();
+		wvar.clear ();
+	};
+
+	/**
+	 * The distribution of the time taken to travel between two points.
+	 *
+	 * The time spent in a partly-traveled segment is the same fraction
+	 * of its travel time; the time spent at the stops and intersections
+	 * in between is included, but not any at either end.
+	 *
+	 * @param from the starting distance into the trip
+	 * @param to   the final distance into the trip
+	 * @param m    set to the mean travel time (seconds)
+	 * @param v    set to the variance of the travel time
+	 */
+	void RouteTimes::travel_time (double from, double to, double& m, double& v) const {
+		m = v = 0.0;
+		unsigned L (mean.size ());
+		if (L == 0 || to <= from) return;
+
+		auto segment = [&] (double d) -> unsigned {
+			unsigned k = std::upper_bound (start.begin (), start.begin () + L, d) - start.begin ();
+			return k > 0 ? k - 1 : 0;
+		};
+		auto fraction = [&] (unsigned k, double d) -> double {
+			double span = start[k+1] - start[k];
+			return span > 0 ? fmin (fmax ((d - start[k]) / span, 0.0), 1.0) : 0.0;
+		};
+		unsigned a = segment (from), b = segment (to);
+		double fa = fraction (a, from), fb = fraction (b, to);
+		m = cmean[b] + fb * mean[b] - cmean[a] - fa * mean[a];
+		if (a == b) {
+			v = pow (fb - fa, 2) * var[a];
+		} else {
+			v = pow (1 - fa, 2) * var[a] + cvar[b] - cvar[a+1] + fb * fb * var[b];
+		}
+
+		unsigned e1 = std::upper_bound (event.begin (), event.end (), from) - event.begin ();
+		unsigned e2 = std::lower_bound (event.begin (), event.end (), to) - event.begin ();
+		if (e2 > e1) {
+			m += wmean[e2] - wmean[e1];
+			v += wvar[e2] - wvar[e1];
+		}
+	};
+
+	/**
+	 * @param  d a distance into the trip
+	 * @return   1 if the segment leading to d has an estimate
+	 */
+	int RouteTimes::get_cert (double d) const {
+		unsigned L (mean.size ());
+		if (L == 0) return 0;
+		unsigned k = std::lower_bound (start.begin (), start.begin () + L, d) - start.begin ();
+		return cert[k > 0 ? k - 1 : 0];
+	};
+
+}; // end namespace gtfs
@@ -1,28 +1,39 @@
 #include <iostream>
+#include <mutex>
 
 #include <gtfs.h>
 #include <sqlite3.h>
 
 namespace gtfs {
 
+	/**
+	 * Locks held while segments are brought forward, shared between segments by ID
+	 * (so segments themselves can still be copied).
+	 */
+	static std::mutex catch_up_locks[64];
+
 	/**
 	 * Add travel time observations to a segment
+	 * (safe for several vehicles to do at once).
+	 *
 	 * @param mean     mean of particles' travel times
 	 * @param variance variance of particles' travel times
 	 */
 	void Segment::add_data (int mean, double var) {
 		if (var == 0) var = 100.0;
-		data.emplace_back (mean, var);
+		data.add (mean, var);
 	};
 
 	/**
-	 * Perform EKF prediction step (X_{c|c-1}, P_{c|c-1}) to use for all the things
+	 * Perform EKF prediction step (X_{c|c-1}, P_{c|c-1}) to use for all the things.
+	 *
+	 * Each second, the state moves a fraction psi of the way back to the prior,
+	 * so after delta seconds what is left of the difference is (1 - psi)^delta,
+	 * and the prediction is computed directly however long it has been.
+	 *
 	 * @param t the new time to predict to
 	 */
 	void Segment::predict (time_t t) {
-		std::clog << "\n + Segment " << id << ": "
-			<< "[" << round(travel_time * 100.0) / 100.0 << ", " << round(travel_time_var * 100.0) / 100.0 << "]";
-
 		double prior_mean = travel_time;
 		if (length > 0) {
 			prior_mean = (double)length / 10.0; // = travel time @ 10m/s ~= 30km/h
@@ -32,57 +43,74 @@ namespace gtfs {
 			travel_time = (prior_mean == 0) ? 100 : prior_mean;
 			travel_time_var = pow(travel_time, 2);
 			timestamp = t;
-			std::clog << " -> initiatialised " 
-				<< "[" << round(travel_time * 100.0) / 100.0 << ", " << round(travel_time_var * 100.0) / 100.0 << "]";
+			version++;
 			return;
 		}
+		if ((uint64_t)t <= timestamp) return;
 		double prior_var = pow(prior_mean, 2);
 
 		int delta = t - timestamp;
 		double psi = 0.001 * travel_time_var / (travel_time_var + prior_var);
 		double Fn = pow(1 - psi, delta);
-		double Q  = prior_var * (1 - pow(1 - psi, 2 * delta));
-
-
-		// The F(beta) function ...
-		for (int i=0; i<delta; i++) {
-			travel_time += psi * (prior_mean - travel_time);
-		}
-		travel_time_var = pow(Fn, 2) * travel_time_var + Q;
 
+		travel_time = prior_mean + Fn * (travel_time - prior_mean);
+		travel_time_var = Fn * Fn * travel_time_var + prior_var * (1 - Fn * Fn);
 		timestamp = t;
-		std::clog << " -> " 
-			<< "[" << round(travel_time) << ", " << round(travel_time_var * 100) / 100.0 << "]";
 	}
 
+	/**
+	 * Bring the estimate forward to the segment's clock, if it has one.
+	 *
+	 * Segments are predicted lazily, when they are read or updated,
+	 * so those no vehicle touches cost nothing.
+	 * Vehicles read segments concurrently, so the prediction is locked.
+	 */
+	void Segment::catch_up (void) {
+		if (!clock || *clock == 0) return;
+		std::lock_guard<std::mutex> lock (catch_up_locks[id % 64]);
+		if (*clock > timestamp) predict (*clock);
+	};
+
+	/**
+	 * Summarise the travel time observations, and discard them.
+	 * Must not be called while vehicles are adding observations.
+	 *
+	 * @param  mean set to the mean of the observations
+	 * @param  var  set to their variance (including each one's own)
+	 * @return      false if there are none
+	 */
+	bool Segment::take_data (double& mean, double& var) {
+		return data.take (mean, var);
+	};
+
+	/**
+	 * Replace the estimate (e.g., with one updated elsewhere).
+	 *
+	 * @param mean the travel time
+	 * @param var  its variance
+	 */
+	void Segment::set_estimate (double mean, double var) {
+		travel_time = mean;
+		travel_time_var = var;
+		version++;
+	};
+
 	/**
 	 * Perform Kalman filter UPDATE on the segment, using data
 	 */
 	void Segment::update () {
 
-		if (data.size () == 0) return;
-		std::clog << "\n + Segment " << id << ":\n   - Data: ";
-
-		double Bhat = 0.0, Ehat = 0.0;
-		for (auto& d: data) {
-			std::clog << std::get<0>(d) << " (" << std::get<1>(d) << "),";
-			Bhat += std::get<0>(d);
-			Ehat += pow(std::get<0>(d), 2) + std::get<1>(d);
-		}
-		std::clog << " => " << Bhat << ", " << Ehat;
-		if (data.size () > 1) {
-			Bhat /= (double)data.size ();
-			Ehat /= (double)data.size ();
-		}
-		Ehat -= pow(Bhat, 2);
-		std::clog << " => " << Bhat << " (" << Ehat << ")";
-		data.clear (); // finished with the data.
+		double Bhat, Ehat;
+		if (!take_data (Bhat, Ehat)) return;
+		catch_up ();
+		std::clog << "\n + Segment " << id << ":\n   - Data: " << Bhat << " (" << Ehat << ")";
 
 		std::clog << "\n   - State: " << travel_time << " (" << travel_time_var << ")";
 
 		double K = travel_time_var / (travel_time_var + Ehat);
 		travel_time += K * (Bhat - travel_time);
 		travel_time_var *= (1 - K);
+		version++;
 
 		std::clog << " => " << travel_time << " (" << travel_time_var << ")";
 		if (length > 0 && travel_time > 0) {
@@ -0,0 +1,393 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
+#include <sqlite3.h>
+
+#include <gtfs.h>
+
+namespace gtfs {
+
+	/**
+	 * A symmetric positive definite matrix, stored sparsely:
+	 * the diagonal, and the off-diagonal entries of each row.
+	 */
+	struct SparseSystem {
+		std::vector<double> diag;     /*!< the diagonal */
+		std::vector<unsigned> start;  /*!< row i's entries are nbr/off[start[i]] to [start[i+1] - 1] */
+		std::vector<unsigned> nbr;    /*!< the column of each off-diagonal entry */
+		std::vector<double> off;      /*!< the value of each off-diagonal entry */
+
+		/** y = A x */
+		void multiply (const std::vector<double>& x, std::vector<double>& y) const {
+			for (unsigned i=0; i<diag.size (); i++) {
+				double s = diag[i] * x[i];
+				for (unsigned e=start[i]; e<start[i+1]; e++) s += off[e] * x[nbr[e]];
+				y[i] = s;
+			}
+		};
+
+		/**
+		 * Solve A x = b by conjugate gradients, preconditioned with the diagonal.
+		 * @param b the right hand side
+		 * @param x the starting value, and the solution
+		 */
+		void solve (const std::vector<double>& b, std::vector<double>& x) const {
+			unsigned n = diag.size ();
+			std::vector<double> r (n), z (n), p (n), Ap (n);
+			multiply (x, Ap);
+			double bb = 0, rz = 0;
+			for (unsigned i=0; i<n; i++) {
+				r[i] = b[i] - Ap[i];
+				z[i] = r[i] / diag[i];
+				p[i] = z[i];
+				rz += r[i] * z[i];
+				bb += b[i] * b[i];
+			}
+			double tol = 1e-20 * fmax (bb, 1e-300);
+			for (unsigned k=0; k<n + 10; k++) {
+				double rr = 0;
+				for (unsigned i=0; i<n; i++) rr += r[i] * r[i];
+				if (rr <= tol) break;
+				multiply (p, Ap);
+				double pAp = 0;
+				for (unsigned i=0; i<n; i++) pAp += p[i] * Ap[i];
+				double alpha = rz / pAp, rz2 = 0;
+				for (unsigned i=0; i<n; i++) {
+					x[i] += alpha * p[i];
+					r[i] -= alpha * Ap[i];
+					z[i] = r[i] / diag[i];
+					rz2 += r[i] * z[i];
+				}
+				double beta = rz2 / rz;
+				rz = rz2;
+				for (unsigned i=0; i<n; i++) p[i] = z[i] + beta * p[i];
+			}
+		};
+
+		/**
+		 * The diagonal of the inverse.
+		 *
+		 * The inverse's entries fade quickly away from the diagonal
+		 * (by a constant factor for each link between segments),
+		 * so each is found from the rows within `radius` links of it,
+		 * holding the rest at zero.
+		 *
+		 * @param d       set to the diagonal of A^-1
+		 * @param radius  how many links to look along
+		 * @param threads the number of threads to use
+		 */
+		void inverse_diag (std::vector<double>& d, unsigned radius, int threads) const {
+			unsigned n = diag.size ();
+			d.resize (n);
+			#pragma omp parallel num_threads(threads) if(threads > 1)
+			{
+			std::vector<int> local (n, -1);
+			std::vector<unsigned> rows;
+			#pragma omp for schedule(static)
+			for (unsigned i=0; i<n; i++) {
+				// the rows nearby, breadth first
+				rows.assign (1, i);
+				local[i] = 0;
+				unsigned level_end = 1, r = 0;
+				for (unsigned k=0; k<rows.size () && r<radius; k++) {
+					for (unsigned e=start[rows[k]]; e<start[rows[k]+1]; e++) {
+						if (local[nbr[e]] >= 0) continue;
+						local[nbr[e]] = rows.size ();
+						rows.push_back (nbr[e]);
+					}
+					if (k + 1 == level_end) {
+						level_end = rows.size ();
+						r++;
+					}
+				}
+				SparseSystem sub;
+				sub.start.push_back (0);
+				for (auto j: rows) {
+					sub.diag.push_back (diag[j]);
+					for (unsigned e=start[j]; e<start[j+1]; e++) {
+						if (local[nbr[e]] < 0) continue;
+						sub.nbr.push_back (local[nbr[e]]);
+						sub.off.push_back (off[e]);
+					}
+					sub.start.push_back (sub.nbr.size ());
+				}
+				for (auto j: rows) local[j] = -1;
+				std::vector<double> e (rows.size (), 0.0), x (rows.size (), 0.0);
+				e[0] = 1.0;
+				x[0] = 1.0 / diag[i];
+				sub.solve (e, x);
+				d[i] = x[0];
+			}
+			}
+		};
+	};
+
+	// --- METHODS
+
+	/**
+	 * Add a segment to the network (if it isn't already).
+	 *
+	 * @param  sg the segment
+	 * @return    its position in the network
+	 */
+	unsigned SegmentNetwork::add (std::shared_ptr<Segment> sg) {
+		auto it = index.find (sg->get_id ());
+		if (it != index.end ()) return it->second;
+		index.emplace (sg->get_id (), segments.size ());
+		segments.push_back (sg);
+		built = false;
+		return segments.size () - 1;
+	};
+
+	/**
+	 * Record that one segment follows another (along some shape).
+	 *
+	 * @param from the first segment
+	 * @param to   the segment that follows it
+	 */
+	void SegmentNetwork::link (std::shared_ptr<Segment> from, std::shared_ptr<Segment> to) {
+		if (!from || !to) return;
+		unsigned a = add (from), b = add (to);
+		if (a == b) return;
+		links.emplace_back (std::min (a, b), std::max (a, b));
+		built = false;
+	};
+
+	/**
+	 * Load every segment, and link those which follow one another
+	 * along the shapes (from the shape_segments table).
+	 *
+	 * @param gtfs the GTFS object, whose database is read
+	 */
+	void SegmentNetwork::load (GTFS& gtfs) {
+		for (auto& s: gtfs.get_segments ()) add (s.second);
+
+		sqlite3 *db;
+		if (sqlite3_open (gtfs.get_dbname ().c_str (), &db)) {
+			std::cerr << " * Can't open database: " << sqlite3_errmsg (db) << "\n";
+			throw std::runtime_error ("Can't open database.");
+		}
+		sqlite3_stmt* select_segs;
+		if (sqlite3_prepare_v2 (db, "SELECT shape_id, segment_id FROM shape_segments ORDER BY shape_id, leg",
+								-1, &select_segs, 0) != SQLITE_OK) {
+			std::cerr << " * Can't prepare query: " << sqlite3_errmsg (db) << "\n";
+			sqlite3_close (db);
+			throw std::runtime_error ("Can't prepare query.");
+		}
+		std::clog << "\n * Prepared query: SELECT shape_segments";
+		std::string shape_id;
+		std::shared_ptr<Segment> prev;
+		while (sqlite3_step (select_segs) == SQLITE_ROW) {
+			std::string sid = (char*)sqlite3_column_text (select_segs, 0);
+			auto seg = gtfs.get_segment ((unsigned long)sqlite3_column_int (select_segs, 1));
+			if (sid == shape_id) link (prev, seg);
+			shape_id = sid;
+			prev = seg;
+		}
+		sqlite3_finalize (select_segs);
+		sqlite3_close (db);
+		build ();
+	};
+
+	/**
+	 * Build the adjacency lists from the links.
+	 */
+	void SegmentNetwork::build (void) {
+		std::sort (links.begin (), links.end ());
+		links.erase (std::unique (links.begin (), links.end ()), links.end ());
+		unsigned n = segments.size ();
+		adj_start.assign (n + 1, 0);
+		for (auto& l: links) {
+			adj_start[l.first + 1]++;
+			adj_start[l.second + 1]++;
+		}
+		for (unsigned i=0; i<n; i++) adj_start[i+1] += adj_start[i];
+		adj.resize (adj_start[n]);
+		std::vector<unsigned> fill (adj_start.begin (), adj_start.end () - 1);
+		for (auto& l: links) {
+			adj[fill[l.first]++] = l.second;
+			adj[fill[l.second]++] = l.first;
+		}
+		built = true;
+	};
+
+	/**
+	 * Update every segment with new data, and its neighbours, using a single thread.
+	 *
+	 * @return the number of segments updated
+	 */
+	unsigned SegmentNetwork::update (void) {
+		return update (1);
+	};
+
+	/**
+	 * Update the segments with new data, and those within `hops` of them.
+	 *
+	 * The segments to update fall into groups which are not linked
+	 * (except through segments too far from any data), updated independently.
+	 *
+	 * @param  threads the number of threads to use
+	 * @return         the number of segments updated
+	 */
+	unsigned SegmentNetwork::update (int threads) {
+		if (!built) build ();
+		unsigned n = segments.size ();
+
+		// segments with data, then their neighbours, breadth first
+		std::vector<int> dist (n, -1);
+		std::vector<unsigned> active;
+		for (unsigned i=0; i<n; i++) {
+			if (!segments[i]->has_data ()) continue;
+			if (segments[i]->get_travel_time_var () > 0) {
+				dist[i] = 0;
+				active.push_back (i);
+			} else {
+				// nothing to update yet
+				double m, v;
+				segments[i]->take_data (m, v);
+			}
+		}
+		if (correlation > 0) {
+			for (unsigned k=0; k<active.size (); k++) {
+				unsigned i = active[k];
+				if (dist[i] >= (int)hops) continue;
+				for (unsigned e=adj_start[i]; e<adj_start[i+1]; e++) {
+					unsigned j = adj[e];
+					if (dist[j] >= 0 || segments[j]->get_travel_time_var () <= 0) continue;
+					dist[j] = dist[i] + 1;
+					active.push_back (j);
+				}
+			}
+		}
+
+		// split them into linked groups
+		std::vector<std::vector<unsigned> > groups;
+		std::vector<char> seen (n, 0);
+		for (auto i: active) {
+			if (seen[i]) continue;
+			seen[i] = 1;
+			groups.emplace_back (1, i);
+			auto& g = groups.back ();
+			for (unsigned k=0; k<g.size (); k++) {
+				if (correlation <= 0) break;
+				for (unsigned e=adj_start[g[k]]; e<adj_start[g[k]+1]; e++) {
+					unsigned j = adj[e];
+					if (dist[j] < 0 || seen[j]) continue;
+					seen[j] = 1;
+					g.push_back (j);
+				}
+			}
+		}
+
+		// large groups share the threads, then small groups get one each
+		for (auto& g: groups) if (g.size () >= 256) update (g, threads);
+		#pragma omp parallel for schedule(dynamic) num_threads(threads) if(groups.size () > 1)
+		for (unsigned k=0; k<groups.size (); k++) {
+			if (groups[k].size () < 256) update (groups[k], 1);
+		}
+
+		return active.size ();
+	};
+
+	/**
+	 * Jointly update a linked group of segments, some with data.
+	 *
+	 * Each segment's error (its true travel time less the estimate,
+	 * divided by the standard deviation) has a standard normal prior;
+	 * they are correlated through a Gaussian Markov random field with
+	 * precision I + kappa L (L being the graph Laplacian of the group),
+	 * rescaled so that each error still has unit variance.
+	 * Adding the data's information then gives the posterior,
+	 * whose mean and marginal variances are found by conjugate gradients.
+	 * With one segment, this is the usual Kalman filter update.
+	 *
+	 * @param nodes   the segments' positions in the network
+	 * @param threads the number of threads to use
+	 */
+	void SegmentNetwork::update (std::vector<unsigned>& nodes, int threads) {
+		unsigned m = nodes.size ();
+		std::vector<double> tt (m), sd (m), h (m, 0.0), y (m, 0.0);
+		std::vector<bool> exact (m, false);
+		for (unsigned a=0; a<m; a++) {
+			auto& sg = segments[nodes[a]];
+			tt[a] = sg->get_travel_time ();
+			sd[a] = sqrt (sg->get_travel_time_var ());
+			double B, E;
+			if (sg->take_data (B, E)) {
+				y[a] = (B - tt[a]) / sd[a];
+				// data without error pins the segment (K = 1)
+				if (E > 0) h[a] = pow (sd[a], 2) / E;
+				else exact[a] = true;
+			}
+		}
+
+		// the prior precision, I + kappa L
+		double kappa = correlation / (1 - correlation);
+		// along a chain, its inverse fades by lambda per link:
+		// look far enough for the variances to be within 1e-4
+		double lambda = kappa > 0 ? (1 + 2 * kappa - sqrt (1 + 4 * kappa)) / (2 * kappa) : 0;
+		unsigned radius = lambda > 0 ? (unsigned)ceil (log (1e-4) / (2 * log (lambda))) : 1;
+		SparseSystem A;
+		A.diag.assign (m, 1.0);
+		A.start.assign (m + 1, 0);
+		if (m > 1) {
+			std::unordered_map<unsigned, unsigned> local;
+			for (unsigned a=0; a<m; a++) local.emplace (nodes[a], a);
+			for (unsigned a=0; a<m; a++) {
+				unsigned i = nodes[a];
+				for (unsigned e=adj_start[i]; e<adj_start[i+1]; e++) {
+					auto it = local.find (adj[e]);
+					if (it == local.end ()) continue;
+					A.nbr.push_back (it->second);
+					A.off.push_back (-kappa);
+					A.diag[a] += kappa;
+				}
+				A.start[a+1] = A.nbr.size ();
+			}
+		}
+
+		// rescale to unit variances
+		std::vector<double> s (m, 1.0);
+		if (m > 1) {
+			A.inverse_diag (s, radius, threads);
+			for (unsigned a=0; a<m; a++) {
+				A.diag[a] *= s[a];
+				for (unsigned e=A.start[a]; e<A.start[a+1]; e++)
+					A.off[e] *= sqrt (s[a] * s[A.nbr[e]]);
+			}
+		}
+
+		// add the data, and solve
+		std::vector<double> b (m), u (m, 0.0), v (m);
+		for (unsigned a=0; a<m; a++) {
+			A.diag[a] += h[a];
+			b[a] = h[a] * y[a];
+		}
+		// condition on the pinned errors, keeping A symmetric
+		for (unsigned a=0; a<m; a++) {
+			if (!exact[a]) continue;
+			for (unsigned e=A.start[a]; e<A.start[a+1]; e++) {
+				unsigned c = A.nbr[e];
+				if (!exact[c]) b[c] -= A.off[e] * y[a];
+				A.off[e] = 0;
+				for (unsigned f=A.start[c]; f<A.start[c+1]; f++)
+					if (A.nbr[f] == a) A.off[f] = 0;
+			}
+			A.diag[a] = 1;
+			b[a] = y[a];
+		}
+		A.solve (b, u);
+		A.inverse_diag (v, radius, threads);
+		for (unsigned a=0; a<m; a++) if (exact[a]) v[a] = 0;
+
+		for (unsigned a=0; a<m; a++) {
+			double mean = tt[a] + sd[a] * u[a];
+			// neighbours of a much faster segment could overshoot
+			if (mean <= 0) mean = tt[a] / 2;
+			segments[nodes[a]]->set_estimate (mean, v[a] * pow (sd[a], 2));
+		}
+	};
+
+}; // end namespace gtfs
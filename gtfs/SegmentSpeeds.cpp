@@ -0,0 +1,94 @@
+#include <vector>
+
+#include <gtfs.h>
+
+namespace gtfs {
+
+	// --- METHODS
+
+	/**
+	 * Draw the speeds for every segment from `from` to the end of the route,
+	 * keeping those already drawn while the segment's estimate is unchanged.
+	 *
+	 * @param  route the vehicle's route
+	 * @param  from  the first segment needed
+	 * @param  rows  the number of sets of speeds
+	 * @param  rng   a random number generator
+	 * @return       true if any speeds were (re)drawn
+	 */
+	bool SegmentSpeeds::draw (Route& route, unsigned from, unsigned rows, sampling::RNG& rng) {
+		auto& stops = route.get_stops ();
+		auto& segments = route.get_shape ()->get_segments ();
+		unsigned L (segments.size ());
+		if (rows != this->rows || length.size () != L) {
+			this->rows = rows;
+			length.assign (L, 0.0);
+			speed.assign (rows * L, 0.0);
+			cert.assign (rows * L, 0);
+			version.assign (L, 0);
+			drawn.assign (L, 0);
+		}
+		this->from = from;
+
+		for (unsigned i=from; i<L; i++) {
+			if (segments[i].segment->get_length () > 0) {
+				length[i] = segments[i].segment->get_length ();
+			} else if (i < L-1) {
+				length[i] = segments[i+1].shape_dist_traveled - segments[i].shape_dist_traveled;
+			} else {
+				length[i] = stops.back ().shape_dist_traveled - segments[i].shape_dist_traveled;
+			}
+		}
+
+		bool changed = false;
+		for (unsigned r=0; r<rows; r++) {
+			for (unsigned i=from; i<L; i++) {
+				auto& sg = segments[i].segment;
+				if (drawn[i] && version[i] == sg->get_version ()) continue;
+				changed = true;
+				double len = length[i], vel = 0;
+				unsigned char c = 0;
+				if (sg && sg->get_timestamp () > 0) {
+					int natt = 0;
+					double trtime;
+					c = 1;
+					while (vel <= 0 || vel > 30) {
+						trtime = rng.rnorm () * sg->get_travel_time_var () +
+							sg->get_travel_time ();
+						vel = len / trtime;
+						natt++;
+						if (natt == 20) {
+							vel = 12;
+							c = 0;
+						}
+					}
+				} else {
+					while (vel <= 0 || vel > 30) {
+						vel = rng.rnorm () * 5 + 15;
+					}
+				}
+				speed[r * L + i] = vel;
+				cert[r * L + i] = c;
+			}
+		}
+		for (unsigned i=from; i<L; i++) {
+			drawn[i] = 1;
+			version[i] = segments[i].segment->get_version ();
+		}
+		return changed;
+	};
+
+	/**
+	 * Discard all of the speeds (e.g., when the vehicle starts a new trip).
+	 */
+	void SegmentSpeeds::clear (void) {
+		rows = 0;
+		from = 0;
+		length.clear ();
+		speed.clear ();
+		cert.clear ();
+		version.clear ();
+		drawn.clear ();
+	};
+
+}; // end namespace gtfs
@@ -13,6 +13,7 @@ namespace gtfs {
 	 */
 	void Shape::set_path (std::vector<ShapePt>& path) {
 		(*this).path = path;
+		index = ShapeIndex (path);
 	};
 
 	/**
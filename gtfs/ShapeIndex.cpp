@@ -0,0 +1,189 @@
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+
+#include <gtfs.h>
+
+namespace gtfs {
+	/**
+	 * Build the index for a shape's path.
+	 *
+	 * The path is projected about its first point.
+	 *
+	 * @param path the sequence of shape points, ordered by distance
+	 */
+	ShapeIndex::ShapeIndex (const std::vector<ShapePt>& path) {
+		if (path.size () == 0) return;
+		proj = gps::Projection (path[0].pt);
+
+		unsigned n = path.size ();
+		dist.resize (n);
+		x.resize (n);
+		y.resize (n);
+		bx.resize (n, 0.0);
+		by.resize (n, 0.0);
+		for (unsigned i=0; i<n; i++) {
+			dist[i] = path[i].dist_traveled;
+			proj.project (path[i].pt, x[i], y[i]);
+		}
+		for (unsigned i=0; i+1<n; i++) {
+			double len = dist[i+1] - dist[i];
+			if (len <= 0) continue;
+			bx[i] = (x[i+1] - x[i]) / len;
+			by[i] = (y[i+1] - y[i]) / len;
+		}
+
+		grid = gps::Grid (proj, x, y, 100.0);
+	};
+
+	// --- METHODS
+
+	/**
+	 * Find the vertex at the start of the leg containing a given distance.
+	 * @param  distance distance along the path, in meters
+	 * @return          index i such that dist[i] <= distance < dist[i+1]
+	 *                  (clamped to the first and last legs)
+	 */
+	unsigned ShapeIndex::find (double distance) const {
+		if (dist.size () < 2) return 0;
+		auto it = std::upper_bound (dist.begin (), dist.end (), distance);
+		if (it == dist.begin ()) return 0;
+		unsigned i = (it - dist.begin ()) - 1;
+		return std::min (i, (unsigned)dist.size () - 2);
+	};
+
+	/**
+	 * Compute the planar position of a point a given distance along the path.
+	 * @param distance distance along the path, in meters
+	 * @param px       set to meters east of the projection's origin
+	 * @param py       set to meters north of the projection's origin
+	 */
+	void ShapeIndex::project (double distance, double& px, double& py) const {
+		if (dist.size () == 0) {
+			px = py = 0.0;
+			return;
+		}
+		if (distance >= dist.back ()) {
+			px = x.back ();
+			py = y.back ();
+			return;
+		}
+		unsigned i = find (distance);
+		double dd = distance - dist[i];
+		px = x[i] + dd * bx[i];
+		py = y[i] + dd * by[i];
+	};
+
+	/**
+	 * Compute the planar position of a point a given distance along the path,
+	 * and the direction of travel there.
+	 * @param distance distance along the path, in meters
+	 * @param px       set to meters east of the projection's origin
+	 * @param py       set to meters north of the projection's origin
+	 * @param tx       set to the east component of the unit direction of travel
+	 * @param ty       set to the north component of the unit direction of travel
+	 */
+	void ShapeIndex::project (double distance, double& px, double& py,
+							  double& tx, double& ty) const {
+		tx = ty = 0.0;
+		project (distance, px, py);
+		if (dist.size () < 2) return;
+		unsigned i = find (distance);
+		double b = sqrt (bx[i] * bx[i] + by[i] * by[i]);
+		if (b == 0) return;
+		tx = bx[i] / b;
+		ty = by[i] / b;
+	};
+
+	/**
+	 * Get the coordinates of a point a given distance along the path.
+	 * @param  distance distance along the path, in meters
+	 * @return          a coordinate object
+	 */
+	gps::Coord ShapeIndex::get_coords (double distance) const {
+		if (dist.size () == 0) return gps::Coord ();
+		double px, py;
+		project (distance, px, py);
+		return proj.unproject (px, py);
+	};
+
+	/**
+	 * Get the coordinates of many points along the path in a single pass.
+	 *
+	 * The distances must be sorted in increasing order,
+	 * which allows the legs to be found by merging
+	 * rather than searching for each point.
+	 *
+	 * @param distances sorted distances along the path, in meters
+	 * @param coords    filled with the coordinates of each point
+	 */
+	void ShapeIndex::get_coords (const std::vector<double>& distances,
+								 std::vector<gps::Coord>& coords) const {
+		coords.resize (distances.size ());
+		if (dist.size () == 0) return;
+
+		unsigned n = dist.size ();
+		unsigned i = find (distances.size () > 0 ? distances[0] : 0.0);
+		for (unsigned k=0; k<distances.size (); k++) {
+			double d = distances[k];
+			if (d >= dist.back ()) {
+				coords[k] = proj.unproject (x.back (), y.back ());
+				continue;
+			}
+			while (i + 2 < n && dist[i+1] <= d) i++;
+			double dd = d - dist[i];
+			coords[k] = proj.unproject (x[i] + dd * bx[i], y[i] + dd * by[i]);
+		}
+	};
+
+	/**
+	 * Find the legs of the path that might pass near a point.
+	 *
+	 * Leg i joins vertices i and i+1; the legs returned are candidates only,
+	 * so any exact distance check is left to the caller.
+	 *
+	 * @param p      the point, usually a GPS observation
+	 * @param radius the search radius, in meters
+	 * @param legs   filled with the sorted indexes of candidate legs
+	 */
+	void ShapeIndex::near (const gps::Coord& p, double radius,
+						   std::vector<unsigned>& legs) const {
+		double px, py;
+		proj.project (p, px, py);
+		grid.query (px, py, radius, legs);
+	};
+
+	/**
+	 * Snap a point onto the path.
+	 * @param  p      the point, usually a GPS observation
+	 * @param  radius the maximum distance from the path, in meters
+	 * @return        the distance along the path of the nearest point on the path,
+	 *                or -1 if the path doesn't pass within `radius` of the point
+	 */
+	double ShapeIndex::snap (const gps::Coord& p, double radius) const {
+		if (dist.size () == 0) return -1.0;
+		double px, py;
+		proj.project (p, px, py);
+		std::vector<unsigned> legs;
+		grid.query (px, py, radius, legs);
+
+		double best = radius * radius, d = -1.0;
+		for (auto i: legs) {
+			unsigned j = std::min (i + 1, (unsigned)dist.size () - 1);
+			double ux = x[j] - x[i], uy = y[j] - y[i];
+			double len2 = ux * ux + uy * uy;
+			double t = 0.0;
+			if (len2 > 0) {
+				t = ((px - x[i]) * ux + (py - y[i]) * uy) / len2;
+				t = std::max (0.0, std::min (1.0, t));
+			}
+			double dx = x[i] + t * ux - px, dy = y[i] + t * uy - py;
+			if (dx * dx + dy * dy <= best) {
+				best = dx * dx + dy * dy;
+				d = dist[i] + t * (dist[j] - dist[i]);
+			}
+		}
+		return d;
+	};
+
+}; // end namespace gtfs
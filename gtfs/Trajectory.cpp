@@ -0,0 +1,161 @@
+#include <vector>
+#include <algorithm>
+
+#include <gtfs.h>
+
+namespace gtfs {
+	/**
+	 * Create an empty trajectory.
+	 *
+	 * @param window the number of (most recent) values to keep; at least 2,
+	 *               so the latest velocity can always be computed
+	 */
+	Trajectory::Trajectory (unsigned window) : window (window < 2 ? 2 : window) {};
+
+	// --- METHODS
+
+	/**
+	 * The distance at a given time,
+	 * interpolated between the breakpoints either side.
+	 *
+	 * @param  k seconds since the start; must be in [get_first (), size ())
+	 * @return   the distance into the trip
+	 */
+	double Trajectory::operator[] (unsigned k) const {
+		auto& last = pts.back ();
+		if (k >= last.t) return last.d;
+		if (k + 2 == n) return dprev;
+		auto it = std::upper_bound (pts.begin (), pts.end (), k,
+			[](unsigned t, const Breakpoint& b) { return t < b.t; });
+		auto& b = *(it - 1);
+		if (b.t == k) return b.d;
+		return b.d + (k - b.t) * (it->d - b.d) / (it->t - b.t);
+	};
+
+	/**
+	 * @return the retained values, oldest first
+	 */
+	std::vector<double> Trajectory::get_values (void) const {
+		std::vector<double> v;
+		v.reserve (n - first);
+		for (unsigned k=first; k<n; k++) v.push_back ((*this)[k]);
+		return v;
+	};
+
+	/**
+	 * Keep the values at time k, and the second before it (for the velocity),
+	 * exactly, when they are added.
+	 *
+	 * @param k seconds since the start
+	 */
+	void Trajectory::keep (unsigned k) {
+		pinned = k;
+		if (n > 0 && pts.back ().t + 1 >= k && pts.back ().t <= k) soft = false;
+	};
+
+	/**
+	 * Change the distance at time k.
+	 * The values between k and the breakpoints either side change accordingly.
+	 *
+	 * @param k seconds since the start; must be in [get_first (), size ())
+	 * @param d distance into trip (meters)
+	 */
+	void Trajectory::set (unsigned k, double d) {
+		if (k + 2 == n) dprev = d;
+		if (k + 1 == n) soft = false;
+		auto it = std::lower_bound (pts.begin (), pts.end (), k,
+			[](const Breakpoint& b, unsigned t) { return b.t < t; });
+		if (it != pts.end () && it->t == k) {
+			it->d = d;
+		} else {
+			pts.insert (it, Breakpoint {k, d});
+		}
+	};
+
+	/**
+	 * Append the distance for the next second,
+	 * discarding the oldest value if the window is full.
+	 *
+	 * @param d distance into trip (meters)
+	 */
+	void Trajectory::push_back (double d) {
+		if (n > 0) {
+			dprev = pts.back ().d;
+			// the last value is no longer needed exactly: interpolate it
+			if (soft) pts.pop_back ();
+		}
+		pts.push_back (Breakpoint {n, d});
+		soft = n > 0 && n + 1 != pinned && n != pinned;
+		n++;
+		trim ();
+	};
+
+	/**
+	 * Append the same distance for the next k seconds (i.e., the particle waits).
+	 *
+	 * @param d distance into trip (meters)
+	 * @param k the number of seconds
+	 */
+	void Trajectory::push_back (double d, unsigned k) {
+		if (k == 0) return;
+		// the particle stops moving (or jumps): keep the last value
+		soft = false;
+		push_back (d);
+		soft = false;
+		if (k == 1) return;
+		dprev = d;
+		pts.push_back (Breakpoint {n + k - 2, d});
+		n += k - 1;
+		trim ();
+	};
+
+	/**
+	 * Change the length of the trajectory.
+	 *
+	 * Shortening discards the most recent values;
+	 * lengthening repeats the last value (i.e., the particle waits).
+	 *
+	 * @param k the new length
+	 */
+	void Trajectory::resize (unsigned k) {
+		if (k >= n) {
+			if (n == 0) push_back (0.0, k);
+			else push_back (back (), k - n);
+			return;
+		}
+		if (k == 0) {
+			clear ();
+			return;
+		}
+		double d = (*this)[k-1], d2 = k > 1 ? (*this)[k-2] : d;
+		while (pts.size () > 0 && pts.back ().t >= k - 1) pts.pop_back ();
+		pts.push_back (Breakpoint {k - 1, d});
+		dprev = d2;
+		soft = false;
+		n = k;
+		if (first > k) first = k;
+	};
+
+	/**
+	 * Remove all values.
+	 */
+	void Trajectory::clear (void) {
+		pts.clear ();
+		soft = false;
+		dprev = 0.0;
+		pinned = 0;
+		first = 0;
+		n = 0;
+	};
+
+	/**
+	 * Discard the breakpoints which are no longer needed
+	 * once the window is full.
+	 */
+	void Trajectory::trim (void) {
+		if (n - first > window) first = n - window;
+		unsigned i = 0;
+		while (i + 2 < pts.size () && pts[i+1].t <= first) i++;
+		if (i > 0) pts.erase (pts.begin (), pts.begin () + i);
+	};
+}
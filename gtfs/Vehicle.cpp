@@ -1,5 +1,8 @@
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
 
 #include "gtfs.h"
 
@@ -20,8 +23,20 @@ namespace gtfs {
 	 * @param n  integer specifying the number of particles to initialize
 	 *           the vehicle with
 	 */
-	Vehicle::Vehicle (std::string id, unsigned int n) :
-	id (id), n_particles (n), next_id (1) {
+	Vehicle::Vehicle (std::string id, unsigned int n) : Vehicle::Vehicle (id, n, 300) {};
+
+	/**
+	 * Create a vehicle with specified number of particles, ID,
+	 * and the length of trajectory history its particles keep.
+	 *
+	 * @param id     the ID of the vehicle as given in the GTFS feed
+	 * @param n      integer specifying the number of particles to initialize
+	 *               the vehicle with
+	 * @param window the number of seconds of trajectory to keep;
+	 *               must cover the time between observations, plus a minute
+	 */
+	Vehicle::Vehicle (std::string id, unsigned int n, unsigned int window) :
+	id (id), n_particles (n), window (window), next_id (1) {
 		particles.reserve(n_particles);
 		for (unsigned int i=0; i<n_particles; i++) {
 			particles.emplace_back(this);
@@ -61,11 +76,11 @@ namespace gtfs {
 		if (!route) return;
 		auto shape = trip->get_route ()->get_shape ();
 		if (!shape) return;
-		auto segs = shape->get_segments ();
+		auto& segs = shape->get_segments ();
 		if (segs.size () == 0) return;
-		for (auto sg: segs) travel_times.emplace_back (sg.segment);
+		for (auto& sg: segs) travel_times.emplace_back (sg.segment);
 
-		auto stops = route->get_stops ();
+		auto& stops = route->get_stops ();
 		if (stops.size () == 0) return;
 
 		arrival_times.resize (stops.size ());
@@ -149,6 +164,17 @@ namespace gtfs {
 		return dmaxtraveled;
 	};
 
+	/**
+	 * Whether the bus has not moved since the last observation
+	 * (e.g., dwelling at a stop or on layover at a terminus),
+	 * i.e., it is within 10m (twice the GPS error) of where it was.
+	 *
+	 * @return true if the bus is stationary
+	 */
+	bool Vehicle::is_stationary (void) const {
+		return dmaxtraveled >= 0 && dmaxtraveled < 10;
+	};
+
 	// /** @return the vehicle's dwell times at all stops */
 	// const std::vector<DwellTime>& get_dwell_times () const {
 	// 	return dwell_times;
@@ -185,10 +211,39 @@ namespace gtfs {
 	 * @param rng A random number generator
 	 */
 	void Vehicle::update ( sampling::RNG& rng ) {
+		filter (&rng, 1);
+	};
+
+	/**
+	 * Update the vehicle state, splitting the particles across threads.
+	 *
+	 * Used when there are fewer vehicles than cores, so the work
+	 * within a vehicle is shared instead: the particles are divided into
+	 * one contiguous block per thread, each with its own generator.
+	 * Given the same generators, the result does not depend on timing.
+	 *
+	 * @param rngs one random number generator per thread
+	 */
+	void Vehicle::update (std::vector<sampling::RNG>& rngs) {
+		if (rngs.size () == 0) return;
+		filter (rngs.data (), rngs.size ());
+	};
+
+	/**
+	 * Run the particle filter: see update.
+	 *
+	 * @param rngs    random number generators, one per thread;
+	 *                the first is used for the serial parts
+	 * @param threads the number of threads
+	 */
+	void Vehicle::filter (sampling::RNG* rngs, int threads) {
+		sampling::RNG& rng = rngs[0];
+		new_travel_times.clear ();
 		if (!updated || finished) return;
 		// std::clog << "\n - Updating vehicle " << id << ": ("
 		// 	<< travel_times.size () << " segments)";
 		updated = false;
+		etas_current = false;
 
 
 		if (!trip) return;
@@ -196,7 +251,7 @@ namespace gtfs {
 		if (!route) return;
 		auto shape = route->get_shape ();
 		if (!shape) return;
-		auto path = shape->get_path ();
+		auto& path = shape->get_path ();
 		if (path.size () == 0) return;
 		auto stops = route->get_stops ();
 		if (stops.size () == 0) return;
@@ -225,9 +280,11 @@ namespace gtfs {
 
 			// std::clog << "\n --- mutating particles ...";
 			std::cout.flush ();
-			for (auto& p: particles) {
+			#pragma omp parallel for schedule(static) num_threads(threads) if(threads > 1)
+			for (unsigned i=0; i<particles.size (); i++) {
+				auto& p = particles[i];
 				// std::clog << "\n Particle starting at " << p.get_distance () << "m ...";
-				p.mutate (rng);
+				p.mutate (rngs[omp_get_thread_num ()]);
 				// std::clog << " and ending at " << p.get_distance () << "m ...";
 				// for (unsigned ti=0; ti<p.get_travel_times ().size (); ti++) {
 					// std::clog << "\n  [" << ti << ", "
@@ -264,26 +321,25 @@ namespace gtfs {
 			}
 			// std::clog << " done. Calculating likelihoods ...";
 
-			// Check likelihoods are decent
-			double lmax = -INFINITY, lsum = 0.0;
+			// Check likelihoods are decent: if every particle is so far from
+			// the observation that exp(likelihood) underflows,
+			// inflate the GPS error (up to 9 x 5 = 45m!!)
+			calculate_likelihoods (1, threads);
+			const double lmin = log (std::numeric_limits<double>::denorm_min ());
 			int mult = 1;
-			// max 10 iterations (that's, like, as sd of 10*5 = 50m!!)
-			while (lsum == 0) {
-				lsum = 0.0; // reset each time
-				// std::clog << "\n > [" << mult << "]: ";
-				for (auto& p: particles) {
-					p.calculate_likelihood (mult);
-					lmax = fmax(lmax, p.get_likelihood ());
-					lsum += exp(p.get_likelihood ());
-					status = 0;
-					// std::clog << "(" << p.get_likelihood () << ", " << p.get_distance () << ") | ";
-				}
-				mult++;
-				if (mult == 10) {
-					status = 1;
-					break;
+			double lmax = max_likelihood (mult);
+			while (lmax < lmin && mult < 9) lmax = max_likelihood (++mult);
+			if (mult > 1) set_gps_error (mult);
+			status = mult == 9 ? 1 : 0;
+
+			if (rao_blackwell) {
+				double R = pow (5.0 * mult, 2);
+				#pragma omp parallel for schedule(static) num_threads(threads) if(threads > 1)
+				for (unsigned i=0; i<particles.size (); i++) {
+					if (store.located[i]) particles[i].update_speed (store.along[i], R);
 				}
 			}
+
 			double maxl = - log(2 * M_PI * 5 * mult);
 			std::clog << "\n > The max possible likelihood is: " << maxl;
 			std::clog << "\n > Max Likelihood = " << lmax
@@ -339,11 +395,8 @@ namespace gtfs {
 			// check that the variability of weights is sufficient ...
 			if (status == 0) {
 				std::clog << "\n -> Resampling ...";
-				resample (rng);
+				resample (rng, threads);
 				std::clog << " done.";
-				// double Neff = 0.0;
-				// for (auto& p: particles) Neff += exp(2 * p.get_likelihood () - 2 * log(lsum));
-				// Neff = pow(Neff, -1);
 				// if (Neff < 2.0 * particles.size () / 3.0) {
 				// 	std::clog << " -> RESAMPLE";
 				// } else {
@@ -429,6 +482,11 @@ namespace gtfs {
 								travel_times[i].set_time (round (tbar), tvar);
 								std::clog << "\n -> Segment " << i << ": " << round (tbar) 
 									<< "s [" << round(tvar * 100) / 100.0 << "]";
+								// give it to the segment straight away
+								if (travel_times[i].time > 0 && travel_times[i].segment) {
+									travel_times[i].use ();
+									new_travel_times.push_back (i);
+								}
 							} else {
 								travel_times[i].set_time (0.0);
 								std::clog << " ... no particles with travel time";
@@ -483,12 +541,16 @@ namespace gtfs {
 			} else {
 				std::clog << " (case 3)";
 				std::vector<double> init_range {100000.0, 0.0};
-				auto shape = trip->get_route ()->get_shape ();
-				for (auto& p: shape->get_path ()) {
-					if (p.pt.distanceTo(this->position) < 100.0) {
-						double ds (p.dist_traveled);
-						if (ds < init_range[0]) init_range[0] = ds;
-						if (ds > init_range[1]) init_range[1] = ds;
+				// only check the vertices of legs passing near the vehicle
+				std::vector<unsigned> legs;
+				shape->get_index ().near (this->position, 100.0, legs);
+				for (auto i: legs) {
+					for (unsigned k=i; k<=i+1 && k<path.size (); k++) {
+						if (path[k].pt.distanceTo(this->position) < 100.0) {
+							double ds (path[k].dist_traveled);
+							if (ds < init_range[0]) init_range[0] = ds;
+							if (ds > init_range[1]) init_range[1] = ds;
+						}
 					}
 				}
 				double r1 (round(init_range[0] * 100.0) / 100.0),
@@ -514,10 +576,8 @@ namespace gtfs {
 			
 			std::clog << "\n Loading particles ...";
 			double dmean = 0.0;
-			for (auto& p: particles) {
-				p.calculate_likelihood ();
-				dmean += p.get_distance ();
-			}
+			calculate_likelihoods (1, threads);
+			for (auto& p: particles) dmean += p.get_distance ();
 			dmean /= particles.size ();
 			std::clog << " loaded; Dbar = " << dmean << std::endl;
 		}
@@ -553,7 +613,7 @@ namespace gtfs {
 			dmaxtraveled = -1.0;
   			if (position.initialized () && position.distanceTo (newpos) < 50) {
 				// bus has traveled less than 50 metres ...
-				dmaxtraveled = position.distanceTo (newpos) < 50;
+				dmaxtraveled = position.distanceTo (newpos);
 			}
 			position = newpos;
 		}
@@ -645,49 +705,458 @@ namespace gtfs {
 		return next_id++;
 	};
 
+	/**
+	 * The negative log likelihood of a particle's position.
+	 *
+	 * The offset from the reported position is split into the components
+	 * along and across the route; along the route the variance is
+	 * sigma^2 + posvar. With posvar = 0 this is the usual isotropic error.
+	 *
+	 * @param  c0     log (2 pi sigma)
+	 * @param  c1     2 sigma^2
+	 * @param  sqdist squared distance from the reported position
+	 * @param  along  along-track component of that distance
+	 * @param  posvar variance of the particle's distance along the route
+	 * @return        the negative log likelihood
+	 */
+	static inline double gps_error (double c0, double c1,
+									double sqdist, double along, double posvar) {
+		double c2 = c1 + 2 * posvar;
+		return c0 + 0.5 * log (c2 / c1) + along * along / c2 +
+			fmax (sqdist - along * along, 0.0) / c1;
+	};
+
+	/**
+	 * Compute the likelihood of every particle at once.
+	 *
+	 * Equivalent to calling Particle::calculate_likelihood on each particle,
+	 * but the values are first gathered into the vehicle's ParticleStore
+	 * so the GPS and arrival/departure terms are evaluated in
+	 * branch-free loops over contiguous arrays, which the compiler vectorizes.
+	 * The two terms are kept separately, so the GPS error can later be
+	 * changed using set_gps_error without recomputing either.
+	 *
+	 * @param mult GPS error multiplier
+	 */
+	void Vehicle::calculate_likelihoods (int mult) {
+		calculate_likelihoods (mult, 1);
+	};
+
+	/**
+	 * Compute the likelihood of every particle at once,
+	 * gathering the particle values using several threads.
+	 *
+	 * @param mult    GPS error multiplier
+	 * @param threads the number of threads
+	 */
+	void Vehicle::calculate_likelihoods (int mult, int threads) {
+		unsigned N (particles.size ());
+		store.resize (N);
+		if (N == 0) return;
+
+		double sigx = 10.0;
+
+		std::shared_ptr<Shape> shape;
+		if (trip && trip->get_route ()) shape = trip->get_route ()->get_shape ();
+		if (!shape) {
+			for (unsigned i=0; i<N; i++) {
+				store.located[i] = 0;
+				store.nll_stops[i] = INFINITY;
+			}
+			set_gps_error (mult);
+			return;
+		}
+
+		// --- gather
+		auto& index = shape->get_index ();
+		double vx, vy;
+		index.get_projection ().project (position, vx, vy);
+
+		// 1-based stop sequence of the latest observation, if any
+		unsigned sj = 0;
+		bool use_stop = stop_sequence && stop_sequence.get () > 0;
+		if (use_stop) sj = stop_sequence.get () - 1;
+
+		#pragma omp parallel for schedule(static) num_threads(threads) if(threads > 1)
+		for (unsigned i=0; i<N; i++) {
+			auto& p = particles[i];
+			store.located[i] = p.has_position ();
+			store.along[i] = 0.0;
+			store.posvar[i] = 0.0;
+			if (store.located[i]) {
+				double tx, ty;
+				p.project (index, store.x[i], store.y[i], tx, ty);
+				if (rao_blackwell) {
+					// the speed, and so the distance, is uncertain:
+					// keep the offset along the route separate from the rest
+					store.along[i] = (vx - store.x[i]) * tx + (vy - store.y[i]) * ty;
+					store.posvar[i] = p.get_position_var ();
+				}
+			} else {
+				store.x[i] = vx;
+				store.y[i] = vy;
+			}
+
+			store.arrival[i] = 0;
+			store.dwell[i] = 0;
+			store.obs_arrival[i] = 0;
+			store.obs_departure[i] = 0;
+			if (!use_stop || sj >= p.get_stop_count ()) continue;
+			store.arrival[i] = std::get<0> (p.get_stop_time (sj));
+			store.dwell[i] = std::get<1> (p.get_stop_time (sj));
+			if (arrival_time && timestamp >= get_arrival_time (sj))
+				store.obs_arrival[i] = get_arrival_time (sj) - p.get_start ();
+			if (departure_time && timestamp >= get_departure_time (sj))
+				store.obs_departure[i] = get_departure_time (sj) - p.get_start ();
+		}
+
+		// --- GPS: squared distance between particle and vehicle
+		const double* x = store.x.data ();
+		const double* y = store.y.data ();
+		double* sqdist = store.sqdist.data ();
+		#pragma omp simd
+		for (unsigned i=0; i<N; i++) {
+			double dx = x[i] - vx, dy = y[i] - vy;
+			sqdist[i] = dx * dx + dy * dy;
+		}
+
+		// --- arrival/departure term
+		const int* arr = store.arrival.data ();
+		const int* dw = store.dwell.data ();
+		const int* oarr = store.obs_arrival.data ();
+		const int* odep = store.obs_departure.data ();
+		double* nll = store.nll_stops.data ();
+		double cx = 0.5 * log (2 * M_PI) + log (sigx);
+		double c2 = 2 * pow (sigx, 2);
+		#pragma omp simd
+		for (unsigned i=0; i<N; i++) {
+			unsigned parr = arr[i], pdep = parr + dw[i];
+			int varr = oarr[i], vdep = odep[i];
+			// compare arrival if known, otherwise departure
+			bool has_arr = varr > 0, has_dep = vdep > 0;
+			int tdiff = has_arr ? (int)(parr - varr) : (int)(pdep - vdep);
+			bool possible = has_arr ? parr > 0 && (!has_dep || pdep > 0) : pdep > 0;
+			double term = cx + (double)tdiff * tdiff / c2;
+			if (has_arr && has_dep) {
+				// x | lambda ~ Exp(lambda), lambda = particle dwell time
+				// (a zero particle dwell cannot explain an observed dwell)
+				unsigned pdwell = pdep - parr, vdwell = vdep - varr;
+				unsigned pdiv = pdwell > 0 ? pdwell : 1;
+				term += pdwell > 0 ? log (pdwell) + vdwell / pdiv : INFINITY;
+			}
+			term = possible ? term : INFINITY;
+			nll[i] = has_arr || has_dep ? term : 0.0;
+		}
+
+		set_gps_error (mult);
+	};
+
+	/**
+	 * Re-evaluate the particle likelihoods with a different GPS error.
+	 *
+	 * Uses the terms stored by calculate_likelihoods,
+	 * so only a few arithmetic operations per particle are needed.
+	 * In Rao-Blackwellised mode, the variance of the particle's distance
+	 * is added to the GPS error along the route;
+	 * otherwise the error is the same in all directions.
+	 *
+	 * @param mult GPS error multiplier (i.e., sigma = 5m * mult)
+	 */
+	void Vehicle::set_gps_error (int mult) {
+		unsigned N (store.size ());
+		double sigy = 5.0 * mult;
+		double c0 = log (2 * M_PI * sigy);
+		double c1 = 2 * pow (sigy, 2);
+		const double* sqdist = store.sqdist.data ();
+		const double* along = store.along.data ();
+		const double* posvar = store.posvar.data ();
+		const unsigned char* loc = store.located.data ();
+		const double* nll = store.nll_stops.data ();
+		double* ll = store.log_likelihood.data ();
+		#pragma omp simd
+		for (unsigned i=0; i<N; i++) {
+			double gps = loc[i] ? gps_error (c0, c1, sqdist[i], along[i], posvar[i]) : 0.0;
+			ll[i] = - (gps + nll[i]);
+		}
+
+		// --- scatter
+		for (unsigned i=0; i<N; i++) particles[i].set_likelihood (ll[i]);
+	};
+
+	/**
+	 * The largest particle likelihood for a given GPS error,
+	 * computed from the terms stored by calculate_likelihoods.
+	 *
+	 * @param  mult GPS error multiplier
+	 * @return      the maximum log likelihood
+	 */
+	double Vehicle::max_likelihood (int mult) const {
+		unsigned N (store.size ());
+		double sigy = 5.0 * mult;
+		double c0 = log (2 * M_PI * sigy);
+		double c1 = 2 * pow (sigy, 2);
+		double lmax = -INFINITY;
+		#pragma omp simd reduction(max:lmax)
+		for (unsigned i=0; i<N; i++) {
+			double gps = store.located[i] ?
+				gps_error (c0, c1, store.sqdist[i], store.along[i], store.posvar[i]) : 0.0;
+			lmax = fmax (lmax, - (gps + store.nll_stops[i]));
+		}
+		return lmax;
+	};
+
+	/**
+	 * Normalise the particle weights from their log likelihoods.
+	 *
+	 * Weights are shifted by the maximum log likelihood before
+	 * exponentiating, so they cannot all underflow to zero.
+	 * If no particle is possible, all get the same weight.
+	 *
+	 * @return the effective sample size, (sum w)^2 / sum w^2
+	 */
+	double Vehicle::calculate_weights (void) {
+		unsigned N (particles.size ());
+		store.log_likelihood.resize (N);
+		store.weight.resize (N);
+		if (N == 0) return 0.0;
+
+		double* ll = store.log_likelihood.data ();
+		double* wt = store.weight.data ();
+		double lmax = -INFINITY;
+		for (unsigned i=0; i<N; i++) {
+			ll[i] = particles[i].get_likelihood ();
+			lmax = fmax (lmax, ll[i]);
+		}
+		bool flat = lmax == -INFINITY;
+
+		// weights and their sums in a single pass
+		double wsum = 0.0, w2sum = 0.0;
+		#pragma omp simd reduction(+:wsum,w2sum)
+		for (unsigned i=0; i<N; i++) {
+			double w = flat ? 1.0 : exp (ll[i] - lmax);
+			wt[i] = w;
+			wsum += w;
+			w2sum += w * w;
+		}
+		for (unsigned i=0; i<N; i++) {
+			wt[i] /= wsum;
+			particles[i].set_weight (wt[i]);
+		}
+		return pow (wsum, 2) / w2sum;
+	};
+
 	/**
 	 * Perform weighted resampling with replacement.
 	 *
 	 * Use the computed particle weights to resample, with replacement,
 	 * the particles associated with the vehicle.
+	 * Once the vehicle has been resampled twice, no particles are created
+	 * or destroyed: existing ones are overwritten in place.
 	 */
 	void Vehicle::resample (sampling::RNG &rng) {
+		resample (rng, 1);
+	};
+
+	/**
+	 * Perform weighted resampling with replacement,
+	 * copying the particles using several threads.
+	 *
+	 * @param rng     a random number generator
+	 * @param threads the number of threads
+	 */
+	void Vehicle::resample (sampling::RNG &rng, int threads) {
 		// Re-sampler based on computed weights:
-		std::vector<double> lh;
-		lh.reserve (particles.size ());
-		for (auto& p: particles) lh.push_back (exp(p.get_likelihood ()));
+		double Neff = calculate_weights ();
+		std::clog << " (Neff = " << Neff << ")";
 
-		sampling::sample smp (lh);
-		std::vector<int> pkeep (smp.get (n_particles, rng));
+		sampling::sample smp (store.weight);
+		std::vector<int> pkeep (smp.get (n_particles, rng, resampler));
 
-		// Move old particles into temporary holding vector
-		std::vector<gtfs::Particle> old_particles = std::move(particles);
+		// Build the new generation in the spare particles, reusing their storage,
+		// then swap it in; the old generation becomes the next spare.
+		// (IDs are allocated in order, so don't depend on the threads.)
+		unsigned n (pkeep.size ());
+		if (spare.size () > n) spare.erase (spare.begin () + n, spare.end ());
+		spare.reserve (n);
+		unsigned m (spare.size ());
+		unsigned long id0 (next_id);
+		next_id += m;
+		#pragma omp parallel for schedule(static) num_threads(threads) if(threads > 1)
+		for (unsigned i=0; i<m; i++) spare[i].assign (particles[pkeep[i]], id0 + i);
+		for (unsigned i=m; i<n; i++) spare.push_back (particles[pkeep[i]]);
+		particles.swap (spare);
+	};
 
-		// Copy new particles, incrementing their IDs (copy constructor does this)
-		particles.reserve(n_particles);
-		for (auto& i: pkeep) {
-			particles.push_back(old_particles[i]);
+	/**
+	 * Calculate the ETAs of every particle.
+	 *
+	 * ETAs are only recalculated if the particles have changed
+	 * (i.e., the vehicle has been updated) or the speeds of the segments
+	 * ahead have been redrawn; see SegmentSpeeds.
+	 * With `analytic_etas`, the vehicle's ETAs are instead computed
+	 * without simulation; see calculate_eta_intervals.
+	 *
+	 * @param rng a random number generator
+	 */
+	void Vehicle::calculate_etas (sampling::RNG& rng) {
+		calculate_etas (&rng, 1);
+	};
+
+	/**
+	 * Calculate the ETAs of every particle,
+	 * splitting the particles across threads (see update).
+	 *
+	 * @param rngs one random number generator per thread
+	 */
+	void Vehicle::calculate_etas (std::vector<sampling::RNG>& rngs) {
+		if (rngs.size () == 0) return;
+		calculate_etas (rngs.data (), rngs.size ());
+	};
+
+	/**
+	 * Calculate the ETAs of every particle: see calculate_etas.
+	 *
+	 * @param rngs    random number generators, one per thread;
+	 *                the first is used to draw the segment speeds
+	 * @param threads the number of threads
+	 */
+	void Vehicle::calculate_etas (sampling::RNG* rngs, int threads) {
+		if (!trip || !trip->get_route () || particles.size () == 0) return;
+		auto route = trip->get_route ();
+		auto& stops = route->get_stops ();
+		if (stops.size () == 0 || stops.back ().shape_dist_traveled == 0) return;
+		auto shape = route->get_shape ();
+		if (!shape) return;
+		auto& segments = shape->get_segments ();
+		if (segments.size () == 0 || segments.back ().shape_dist_traveled == 0) return;
+		auto& events = route->get_events ();
+		if (analytic_etas) {
+			calculate_eta_intervals ();
+			return;
+		}
+
+		// segments behind every particle are not needed
+		unsigned L (segments.size ()), from (L);
+		for (auto& p: particles) {
+			if (p.is_finished ()) continue;
+			int e = route->find_event (p.get_distance ());
+			from = std::min (from, e > 0 ? (unsigned)events[e-1].segment : 0u);
+		}
+		if (from == L) from = 0;
+
+		unsigned rows = std::max (1u, std::min (eta_rows, (unsigned)particles.size ()));
+		bool redrawn = eta_speeds.draw (*route, from, rows, rngs[0]);
+		if (etas_current && !redrawn) return;
+
+		#pragma omp parallel for schedule(static) num_threads(threads) if(threads > 1)
+		for (unsigned i=0; i<particles.size (); i++)
+			particles[i].calculate_etas (eta_speeds, i % rows);
+		etas_current = true;
+	};
+
+	/**
+	 * A quantile of an equally weighted mixture of normal distributions,
+	 * found by bisection (to within a quarter of a second).
+	 *
+	 * @param  m the means
+	 * @param  s the standard deviations
+	 * @param  n the number of distributions
+	 * @param  p the probability
+	 * @return   x such that P(X <= x) = p
+	 */
+	static double mixture_quantile (const std::vector<double>& m, const std::vector<double>& s,
+									unsigned n, double p) {
+		double lo = INFINITY, hi = -INFINITY;
+		for (unsigned i=0; i<n; i++) {
+			lo = fmin (lo, m[i] - 4 * s[i]);
+			hi = fmax (hi, m[i] + 4 * s[i]);
+		}
+		while (hi - lo > 0.5) {
+			double x = (lo + hi) / 2, F = 0.0;
+			for (unsigned i=0; i<n; i++) F += sampling::pnorm ((x - m[i]) / s[i]);
+			if (F < p * n) lo = x;
+			else hi = x;
+		}
+		return (lo + hi) / 2;
+	};
+
+	/**
+	 * Calculate each stop's ETA from the distribution of travel times
+	 * along the route (analytic ETAs), instead of simulating each particle.
+	 *
+	 * The particles' positions are summarised by `eta_starts` quantiles.
+	 * The arrival time from each is normal, so the ETA is a mixture of normals;
+	 * only the stops' median and 95% interval are kept.
+	 * Nothing is recomputed unless the particles or segment estimates have changed.
+	 */
+	void Vehicle::calculate_eta_intervals (void) {
+		auto route = trip->get_route ();
+		auto& stops = route->get_stops ();
+		bool changed = route_times.update (*route);
+		if (etas_current && !changed) return;
+		etas_current = true;
+
+		eta_intervals.assign (stops.size (), ETAInterval ());
+		std::vector<double> dist, probs, starts;
+		dist.reserve (particles.size ());
+		for (auto& p: particles) {
+			if (!p.is_finished ()) dist.push_back (p.get_distance ());
+		}
+		if (dist.size () == 0) return;
+		unsigned K = std::max (1u, std::min (eta_starts, (unsigned)dist.size ()));
+		for (unsigned k=0; k<K; k++) probs.push_back ((k + 0.5) / K);
+		sampling::quantiles (dist, probs, starts);
+
+		std::vector<double> m (K), s (K);
+		for (unsigned j=0; j<stops.size (); j++) {
+			double d = stops[j].shape_dist_traveled;
+			unsigned n = 0;
+			for (auto& x: starts) {
+				if (x >= d) continue;
+				double v;
+				route_times.travel_time (x, d, m[n], v);
+				s[n] = sqrt (fmax (v, 1.0));
+				n++;
+			}
+			if (n == 0) continue;
+			auto& eta = eta_intervals[j];
+			eta.lower = timestamp + round (fmax (0.0, mixture_quantile (m, s, n, 0.025)));
+			eta.median = timestamp + round (fmax (0.0, mixture_quantile (m, s, n, 0.5)));
+			eta.upper = timestamp + round (fmax (0.0, mixture_quantile (m, s, n, 0.975)));
+			eta.cert = route_times.get_cert (d);
 		}
 	};
 
 	/**
 	 * Reset vehicle's particles to zero-state.
+	 *
+	 * Existing particles are recycled, keeping the memory they have
+	 * already allocated; new ones are only created if there are too few.
+	 * Every particle (including the spare generation) then reserves
+	 * enough space for the current route's stops and segments.
 	 */
 	void Vehicle::reset (void) {
-		// std::clog << "\nClearing " << particles.size () << " particles ...";
-		// std::cout.flush ();
-		particles.clear ();
-		// std::clog << " done.\nReserving memory for particles ...";
-		// std::cout.flush ();
+		if (particles.size () > n_particles)
+			particles.erase (particles.begin () + n_particles, particles.end ());
+		// (reserve first, so existing particles aren't copied)
 		particles.reserve(n_particles);
-		// std::clog << " done.\nInitializing new particles ...";
-		// std::cout.flush ();
-		for (unsigned int i=0; i<n_particles; i++) {
-			particles.emplace_back(this);
+		for (auto& p: particles) p.reset ();
+		while (particles.size () < n_particles) particles.emplace_back (this);
+
+		if (trip && trip->get_route () && trip->get_route ()->get_shape ()) {
+			auto route = trip->get_route ();
+			unsigned J (route->get_stops ().size ()),
+			         L (route->get_shape ()->get_segments ().size ());
+			for (auto& p: particles) p.reserve (J, L);
+			for (auto& p: spare) p.reserve (J, L);
 		}
-		// std::clog << " done.";
 		status = -1;
 		delta = 0;
+		eta_speeds.clear ();
+		route_times.clear ();
+		eta_intervals.clear ();
+		new_travel_times.clear ();
+		etas_current = false;
 	};
 
 }; // end namespace gtfs
@@ -129,6 +129,8 @@ namespace gtfs {
 		}
 		sqlite3_finalize (select_segs);
 		sqlite3_close (db);
+
+		for (auto& s: segments) s.second->set_clock (&now);
 	};
 
 
@@ -248,9 +250,9 @@ namespace gtfs {
 					sqlite3_close (db);
 					return trip;
 				}
-				std::string arr = (char*)sqlite3_column_text (select_stop_times, 1);
-				std::string dep = (char*)sqlite3_column_text (select_stop_times, 2);
-				stoptimes.emplace_back (stop, arr, dep);
+				stoptimes.emplace_back (stop.get (),
+										(const char*)sqlite3_column_text (select_stop_times, 1),
+										(const char*)sqlite3_column_text (select_stop_times, 2));
 			}
 			sqlite3_finalize (select_stop_times);
 			sqlite3_close (db);
@@ -450,18 +452,38 @@ namespace gtfs {
 	 * @return          a coordinate object
 	 */
 	gps::Coord get_coords (double distance, std::shared_ptr<Shape> shape) {
-		auto path = shape->get_path ();
-		for (unsigned int i=0; i<path.size ()-1; i++) {
-			if (distance == path[i].dist_traveled) return path[i].pt;
-			if (path[i+1].dist_traveled > distance) {
-				return path[i].pt.destinationPoint (
-					distance - path[i].dist_traveled,
-					path[i].pt.bearingTo (path[i+1].pt)
-				);
-				break;
-			}
+		return shape->get_index ().get_coords (distance);
+	};
+
+	/**
+	 * Convert a GTFS time string (HH:MM:SS) into seconds since the start
+	 * of the service day.
+	 *
+	 * Hours may exceed 24 (for trips running past midnight),
+	 * and a single-digit hour (H:MM:SS) is also accepted.
+	 *
+	 * @param  str the time string, as stored in the database
+	 * @return     seconds since the start of the day, or -1 if the string is malformed
+	 */
+	int32_t parse_time (const char* str) {
+		if (str == nullptr) return -1;
+		while (*str == ' ') str++;
+
+		int32_t h = 0;
+		int nd = 0;
+		while (*str >= '0' && *str <= '9' && nd < 3) {
+			h = h * 10 + (*str++ - '0');
+			nd++;
 		}
+		if (nd == 0 || *str++ != ':') return -1;
+
+		auto digit = [](char c) { return c >= '0' && c <= '9'; };
+		if (!digit (str[0]) || !digit (str[1]) || str[2] != ':' ||
+			!digit (str[3]) || !digit (str[4])) return -1;
+		int32_t m = (str[0] - '0') * 10 + (str[1] - '0');
+		int32_t s = (str[3] - '0') * 10 + (str[4] - '0');
+		if (m > 59 || s > 59) return -1;
 
-		return path.back ().pt;
+		return h * 3600 + m * 60 + s;
 	};
 };
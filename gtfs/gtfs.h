@@ -5,10 +5,10 @@
 #include <vector>
 #include <memory>
 #include <unordered_map>
+#include <atomic>
 #include <inttypes.h>
 
 #include <boost/optional.hpp>
-#include "boost/date_time/posix_time/posix_time.hpp"
 
 #include "gps.h"
 #include "gtfs-realtime.pb.h"
@@ -25,13 +25,21 @@ namespace gtfs {
 
 	class Vehicle;
 	class Particle;
+	class Trajectory;
+	struct ParticleStore;
+	struct SegmentSpeeds;
+	struct RouteTimes;
+	struct ETAInterval;
 
 	class Route;
 	struct RouteStop;
+	struct RouteEvent;
 	class Trip;
 	class Shape;
+	class ShapeIndex;
 	class ShapeSegment;
 	class Segment;
+	struct TravelTimeSums;
 	struct ShapePt;
 	class Intersection;
 	class Stop;
@@ -86,6 +94,8 @@ namespace gtfs {
 		std::unordered_map<std::string, std::shared_ptr<Route> > routes; /*!< A map of route pointers */
 		std::unordered_map<std::string, std::shared_ptr<Shape> > shapes; /*!< A map of shape pointers */
 
+		uint64_t now = 0; /*!< the network's current time, which segments are predicted to when read */
+
 	public:
 		GTFS (std::string& dbname);
 		GTFS (std::string& dbname, std::string& v);
@@ -93,6 +103,14 @@ namespace gtfs {
 
         std::string& get_dbname (void) { return database_; };
 
+		/** @return the network's current time */
+		uint64_t get_time (void) const { return now; };
+		/**
+		 * Advance the network's clock; segments catch up when next read.
+		 * @param t the current time
+		 */
+		void set_time (uint64_t t) { now = t; };
+
 		// --- Get individual objects
 		std::shared_ptr<Stop> get_stop (std::string& s) const;
 		std::shared_ptr<Intersection> get_intersection (unsigned int i) const;
@@ -116,8 +134,8 @@ namespace gtfs {
 		get_intersections (void) { return intersections; };
 
 		/** @return an unordered map of Segment objects */
-		std::unordered_map<unsigned long, std::shared_ptr<Segment> >
-		get_segments (void) { return segments; };
+		const std::unordered_map<unsigned long, std::shared_ptr<Segment> >&
+		get_segments (void) const { return segments; };
 
 		/** @return an unordered map of Trip objects */
 		std::unordered_map<std::string, std::shared_ptr<Trip> >
@@ -133,6 +151,115 @@ namespace gtfs {
 
 	};
 
+	/**
+	 * Structure-of-arrays view of a vehicle's particles.
+	 *
+	 * The per-particle values needed by the vehicle-level stages of the filter
+	 * are gathered into contiguous arrays (one element per particle),
+	 * so those stages can be evaluated for all particles at once
+	 * in tight, vectorizable loops.
+	 */
+	struct ParticleStore {
+		std::vector<double> x;               /*!< position, meters east of the shape's origin */
+		std::vector<double> y;               /*!< position, meters north of the shape's origin */
+		std::vector<unsigned char> located;  /*!< 1 if the particle has a position at the latest observation */
+		std::vector<double> sqdist;          /*!< squared distance (m^2) from the reported position */
+		std::vector<double> along;           /*!< along-track component of the reported position's offset */
+		std::vector<double> posvar;          /*!< variance of the along-track position due to unknown speed */
+		std::vector<double> nll_stops;       /*!< negative log likelihood of the arrival/departure times */
+		std::vector<double> log_likelihood;  /*!< log likelihood of the latest observation */
+		std::vector<double> weight;          /*!< normalised weight */
+		std::vector<int> arrival;            /*!< arrival time at the last reported stop (seconds after start) */
+		std::vector<int> dwell;              /*!< dwell time at the last reported stop */
+		std::vector<int> obs_arrival;        /*!< reported arrival time, relative to the particle's start */
+		std::vector<int> obs_departure;      /*!< reported departure time, relative to the particle's start */
+
+		/**
+		 * Set the number of particles in the store.
+		 * @param n the number of particles
+		 */
+		void resize (unsigned n) {
+			x.resize (n);
+			y.resize (n);
+			located.resize (n);
+			sqdist.resize (n);
+			along.resize (n);
+			posvar.resize (n);
+			nll_stops.resize (n);
+			log_likelihood.resize (n);
+			weight.resize (n);
+			arrival.resize (n);
+			dwell.resize (n);
+			obs_arrival.resize (n);
+			obs_departure.resize (n);
+		};
+
+		/** @return the number of particles in the store */
+		unsigned size (void) const { return x.size (); };
+	};
+
+	/**
+	 * Segment speeds drawn for the ETAs of a vehicle's particles.
+	 *
+	 * A speed depends only on the state of its segment, so the speeds are
+	 * drawn in a few sets shared by the particles, and each segment's speeds
+	 * are kept (across cycles) until that segment's estimate changes.
+	 * Segments the vehicle has already passed are not drawn.
+	 */
+	struct SegmentSpeeds {
+		unsigned rows = 0;                  /*!< the number of sets of speeds */
+		unsigned from = 0;                  /*!< the first segment drawn */
+		std::vector<double> length;         /*!< the length of each segment */
+		std::vector<double> speed;          /*!< the speed in segment l of set r, at [r * L + l] */
+		std::vector<unsigned char> cert;    /*!< 1 if the speed was drawn from the segment's estimate */
+		std::vector<unsigned long> version; /*!< each segment's version when its speeds were drawn */
+		std::vector<unsigned char> drawn;   /*!< 1 if the segment's speeds have been drawn */
+
+		bool draw (Route& route, unsigned from, unsigned rows, sampling::RNG& rng);
+		void clear (void);
+		/** @return the speed in segment l of set r */
+		double get_speed (unsigned r, unsigned l) const { return speed[r * length.size () + l]; };
+		/** @return 1 if the speed in segment l of set r was drawn from the segment's estimate */
+		int get_cert (unsigned r, unsigned l) const { return cert[r * length.size () + l]; };
+	};
+
+	/**
+	 * The distribution of travel times along a route, for analytic ETAs.
+	 *
+	 * Each segment's travel time is normal, with the segment's estimated
+	 * mean and variance (or, if it has none, those of a 15 +/- 5 m/s speed),
+	 * and each stop or intersection adds the expected wait there.
+	 * All are independent, so the means and variances are kept as
+	 * prefix sums, and the time between any two points needs two searches.
+	 */
+	struct RouteTimes {
+		std::vector<double> start;          /*!< distance at the start of each segment (and the end of the route) */
+		std::vector<double> mean;           /*!< mean travel time of each segment */
+		std::vector<double> var;            /*!< variance of the travel time of each segment */
+		std::vector<double> cmean;          /*!< mean travel time to the start of each segment */
+		std::vector<double> cvar;           /*!< variance of the travel time to the start of each segment */
+		std::vector<unsigned char> cert;    /*!< 1 if the segment has an estimate */
+		std::vector<unsigned long> version; /*!< each segment's version when last computed */
+		std::vector<double> event;          /*!< distance of each stop and intersection */
+		std::vector<double> wmean;          /*!< mean time spent at the stops/intersections before each one */
+		std::vector<double> wvar;           /*!< variance of the time spent at the stops/intersections before each one */
+
+		bool update (Route& route);
+		void clear (void);
+		void travel_time (double from, double to, double& m, double& v) const;
+		int get_cert (double d) const;
+	};
+
+	/**
+	 * A stop's predicted arrival time: the median and a 95% interval.
+	 */
+	struct ETAInterval {
+		uint64_t lower = 0;  /*!< the 2.5% quantile (0 if there is no prediction) */
+		uint64_t median = 0; /*!< the 50% quantile */
+		uint64_t upper = 0;  /*!< the 97.5% quantile */
+		double cert = 0.0;   /*!< proportion of the prediction from a segment with an estimate */
+	};
+
 	/**
 	 * Transit vehicle class
 	 *
@@ -146,6 +273,12 @@ namespace gtfs {
 	private:
 		std::string id; /*!< ID of vehicle, as per GTFS feed */
 		std::vector<Particle> particles; /*!< the particles associated with the vehicle */
+		std::vector<Particle> spare;     /*!< storage for the next generation of particles, reused by resample */
+		ParticleStore store;             /*!< contiguous copy of particle values, for the likelihood */
+		SegmentSpeeds eta_speeds;        /*!< segment speeds shared by the particles' ETAs */
+		RouteTimes route_times;          /*!< travel time distribution along the route (analytic ETAs) */
+		std::vector<ETAInterval> eta_intervals; /*!< each stop's ETA (analytic ETAs) */
+		bool etas_current = false;       /*!< true if the particles' ETAs are up to date */
 
 		bool newtrip;            /*!< if this is true, the next `update()` will reinitialise the particles AFTER finishing!!! */
         bool finished = false;   /*!< set to true once the vehicle has finished the trip */
@@ -167,21 +300,29 @@ namespace gtfs {
 														used to pin down start time */
 		double approx_distance;                    /*!< approximate distance to determine if traveling correct direction */
 
-		double dmaxtraveled = -1.0;                /*!< max distance the bus has traveled if it hasn't traveled far */
+		double dmaxtraveled = -1.0;                /*!< distance the bus has traveled since the last observation, if less than 50m */
 
 		int status = -1;                           /*!< 0 = traveling normally; 1 = poor performance; -1 = uninitialized; */
 		bool updated;                              /*!< if true, need to run update/mutate */
 
         // std::vector<DwellTime> dwell_times;     /*!< vehicle's dwell times at stops */
         std::vector<TravelTime> travel_times;      /*!< vehicle's travel times through segments */
+        std::vector<unsigned> new_travel_times;    /*!< the travel times given to their segments in the latest update */
 
 	public:
 		unsigned int n_particles; /*!< the number of particles that will be created in the next sample */
+		unsigned int window;      /*!< the number of seconds of trajectory each particle keeps */
+		sampling::scheme resampler = sampling::multinomial; /*!< the resampling scheme */
+		bool rao_blackwell = false; /*!< if true, particle speeds are marginalised by a Kalman filter */
+		unsigned int eta_rows = 100; /*!< the number of sets of segment speeds drawn for ETAs */
+		bool analytic_etas = false;  /*!< if true, ETAs are computed from the segments' travel time distributions */
+		unsigned int eta_starts = 20; /*!< the number of particle positions the analytic ETAs are mixed over */
 		unsigned long next_id;    /*!< the ID of the next particle to be created */
 
 		// Constructors, destructors
 		Vehicle (std::string id);
 		Vehicle (std::string id, unsigned int n);
+		Vehicle (std::string id, unsigned int n, unsigned int window);
 		~Vehicle(void);
 
 		// Setters
@@ -190,6 +331,10 @@ namespace gtfs {
 		// Getters
 		std::string get_id (void) const;
 		std::vector<Particle>& get_particles (void);
+		/** @return the structure-of-arrays view of the particles */
+		const ParticleStore& get_store (void) const { return store; };
+		/** @return each stop's ETA, if computed analytically */
+		const std::vector<ETAInterval>& get_eta_intervals (void) const { return eta_intervals; };
 		const std::shared_ptr<Trip>& get_trip (void) const;
 		boost::optional<unsigned> get_stop_sequence (void) const;
 		boost::optional<uint64_t> get_arrival_time (void) const;
@@ -202,6 +347,7 @@ namespace gtfs {
 		int get_delta (void) const;
 		uint64_t get_first_obs (void) const;
 		double get_dmaxtraveled (void) const;
+		bool is_stationary (void) const;
 
 		int get_status (void) const { return status; };
 		bool is_finished (void) const { return finished; };
@@ -211,18 +357,89 @@ namespace gtfs {
 		// const DwellTime* get_dwell_time (unsigned i) const;
 		const std::vector<TravelTime>& get_travel_times () const;
 		TravelTime* get_travel_time (unsigned i);
+		/** @return the travel times (indices) given to their segments in the latest update */
+		const std::vector<unsigned>& get_new_travel_times (void) const { return new_travel_times; };
 
 
 		// Methods
 		void update ( sampling::RNG& rng );
+		void update (std::vector<sampling::RNG>& rngs);
 		void update (const transit_realtime::VehiclePosition &vp, GTFS &gtfs);
 		void update (const transit_realtime::TripUpdate &tu, GTFS &gtfs);
 		unsigned long allocate_id (void);
+		void calculate_likelihoods (int mult);
+		void calculate_likelihoods (int mult, int threads);
+		void set_gps_error (int mult);
+		double max_likelihood (int mult) const;
+		double calculate_weights (void);
 		void resample (sampling::RNG &rng);
+		void resample (sampling::RNG &rng, int threads);
+		void calculate_etas (sampling::RNG& rng);
+		void calculate_etas (std::vector<sampling::RNG>& rngs);
 		void reset (void);
+
+	private:
+		void filter (sampling::RNG* rngs, int threads);
+		void calculate_etas (sampling::RNG* rngs, int threads);
+		void calculate_eta_intervals (void);
 	};
 
 
+	/**
+	 * A particle's distance trajectory, one value per second.
+	 *
+	 * Indices are seconds since the particle's start time, as before,
+	 * but rather than a value for every second, only breakpoints are stored,
+	 * and the trajectory is linear between them. A breakpoint is kept where
+	 * the particle starts or stops waiting, and at the seconds marked with
+	 * `keep` (the observation); the value at every breakpoint is exact.
+	 * Consecutive moving seconds are merged, so their values are approximate.
+	 * Only the most recent `window` seconds are available;
+	 * older history is summarised by the particle's stop and travel times.
+	 */
+	class Trajectory {
+	private:
+		/** A time at which the particle's distance is known exactly. */
+		struct Breakpoint {
+			uint32_t t;  /*!< seconds since the start */
+			double d;    /*!< distance into the trip */
+		};
+		std::vector<Breakpoint> pts; /*!< breakpoints, in time order; the last is at size () - 1 */
+		bool soft = false;        /*!< if true, the last breakpoint is dropped by the next push_back */
+		double dprev = 0.0;       /*!< the exact value at size () - 2 */
+		unsigned pinned = 0;      /*!< values at pinned - 1 and pinned are kept exactly (if > 0) */
+		unsigned window;          /*!< the maximum number of values available */
+		unsigned first = 0;       /*!< index of the oldest available value */
+		unsigned n = 0;           /*!< the length of the trajectory (including discarded values) */
+
+		void trim (void);
+
+	public:
+		Trajectory (unsigned window);
+
+		/** @return the length of the trajectory, in seconds */
+		unsigned size (void) const { return n; };
+		/** @return index of the oldest value still available */
+		unsigned get_first (void) const { return first; };
+		/** @return the maximum number of values available */
+		unsigned get_window (void) const { return window; };
+		/** @return the number of breakpoints stored */
+		unsigned get_breakpoints (void) const { return pts.size (); };
+
+		double operator[] (unsigned k) const;
+		/** @return the most recent distance */
+		double back (void) const { return pts.back ().d; };
+
+		std::vector<double> get_values (void) const;
+
+		void keep (unsigned k);
+		void set (unsigned k, double d);
+		void push_back (double d);
+		void push_back (double d, unsigned k);
+		void resize (unsigned k);
+		void clear (void);
+	};
+
 	/**
 	 * Particle class
 	 *
@@ -236,16 +453,22 @@ namespace gtfs {
 
 		uint64_t start = 0;                /*!< start time; trajectory indices are seconds after this */
 		int latest = 0;                    /*!< index of the latest position update; only adjust trajectory after this */
-        std::vector<double> trajectory;    /*!< particle's distance trajectory, from 0 seconds into trip until end */
+        Trajectory trajectory;             /*!< particle's distance trajectory, from 0 seconds into trip until end */
         std::vector<std::tuple<int,int> > stop_times; /*!< [arrival,dwell] time at each stop along route */
         std::vector<pTravelTime> travel_times;        /*!< [queue,travel] time at each intersection/segment along route */
 
 		std::vector<uint64_t> etas;        /*!< ETAs for the particle */
 		std::vector<int> eta_cert;        /*!< ETAs for the particle */
 
-		bool finished;
+		bool finished = false;             /*!< true once the particle has reached the end of the route */
 
 		double velocity = 0.0;       /*!< the particles velocity at latest time */
+		double vmean = 0.0;          /*!< mean of the particle's speed (Rao-Blackwellised mode) */
+		double vvar = 0.0;           /*!< variance of the particle's speed (Rao-Blackwellised mode) */
+		int tmove = 0;               /*!< seconds spent moving in the current segment before the observation */
+		double dvar = 0.0;           /*!< variance of the distance traveled in earlier segments before the observation */
+		double proj_distance = -1.0; /*!< the distance the cached planar position is for (negative if none) */
+		double proj[4];              /*!< cached planar position (x, y) and direction of travel (tx, ty) */
 		double log_likelihood = 0.0; /*!< the likelihood of the particle, given the data */
 		double weight;               /*!< the weight of this particle (reset to null after resample) */
 
@@ -271,7 +494,21 @@ namespace gtfs {
 		double get_distance (unsigned k) const;
 		double get_distance (void) const;
 		double get_velocity (void) const;
+		/** @return the mean of the particle's speed distribution */
+		double get_speed_mean (void) const { return vmean; };
+		/** @return the variance of the particle's speed distribution */
+		double get_speed_var (void) const { return vvar; };
+		/** @return the variance of the distance at the latest observation due to the unknown speed */
+		double get_position_var (void) const { return dvar + (double)tmove * tmove * vvar; };
 		std::vector<std::tuple<int,int> > get_stop_times (void) const;
+		/** @return the [arrival, dwell] time at stop i */
+		const std::tuple<int,int>& get_stop_time (int i) const { return stop_times[i]; };
+		/** @return the number of stops with [arrival, dwell] times */
+		unsigned get_stop_count (void) const { return stop_times.size (); };
+		/** @return logical, if the particle has a position at the latest observation */
+		bool has_position (void) const {
+			return latest >= 0 && latest < (int)trajectory.size () && latest >= (int)trajectory.get_first ();
+		};
 		std::vector<pTravelTime> get_travel_times (void) const;
 		const pTravelTime& get_travel_time (int i) const;
 
@@ -287,15 +524,25 @@ namespace gtfs {
 		
 
 		// Methods
+		void assign (const Particle &p);
+		void assign (const Particle &p, unsigned long pid);
+		void reset (void);
+		void reserve (unsigned stops, unsigned segments);
 		void initialize (double dist, sampling::RNG& rng);
 		void mutate ( sampling::RNG& rng );
 		void mutate ( sampling::RNG& rng, double );
+		void set_speed_prior (const ShapeSegment& segment);
+		void update_speed (double r, double R);
+		void project (const ShapeIndex& index, double& x, double& y, double& tx, double& ty);
 		void calculate_likelihood (void);
         void calculate_likelihood (int mult);
 		void set_weight (double wt) { weight = wt; };
+		/** Set the particle's log likelihood (computed for the vehicle as a whole) */
+		void set_likelihood (double ll) { log_likelihood = ll; };
 
 		// void reset_travel_time (unsigned i);
 		void calculate_etas (sampling::RNG& rng);
+		void calculate_etas (const SegmentSpeeds& speeds, unsigned r);
 
         // Operators
         bool operator<(const Particle &p2) const {
@@ -321,6 +568,7 @@ namespace gtfs {
 	};
 
 	gps::Coord get_coords (double distance, std::shared_ptr<Shape> shape);
+	int32_t parse_time (const char* str);
 
 
 	/**
@@ -337,6 +585,7 @@ namespace gtfs {
 		std::string route_long_name;   /*!< long name of the route, e.g., Westgate to Britomart */
 		std::shared_ptr<Shape> shape;  /*!< pointer to the route's shape */
 		std::vector<RouteStop> stops;  /*!< vector of route stops + distance into shape */
+		std::vector<RouteEvent> events; /*!< stops and intersections, ordered by distance */
 
 	public:
 		// --- Constructor, destructor
@@ -360,6 +609,9 @@ namespace gtfs {
 		std::shared_ptr<Shape> get_shape () const;
 		/** @return the route's stops so that they're modifiable (incl. distance into trip) */
 		std::vector<RouteStop>& get_stops () { return stops; };
+		/** @return the stops and intersections along the route, in the order they're reached */
+		const std::vector<RouteEvent>& get_events () const { return events; };
+		unsigned find_event (double distance) const;
 
 
 		// --- SETTERS
@@ -369,13 +621,22 @@ namespace gtfs {
 		 * Add a shape to a route.
 		 * @param sh pointer to a Shape object.
 		 */
-		void add_shape (std::shared_ptr<Shape> sh) { shape = sh; };
+		void add_shape (std::shared_ptr<Shape> sh) {
+			shape = sh;
+			build_events ();
+		};
 
 		/**
 		 * Add stops to a route.
 		 * @param s a vector of RouteStop structs.
 		 */
-		void add_stops (std::vector<RouteStop>& s) { stops = s; };
+		void add_stops (std::vector<RouteStop>& s) {
+			stops = s;
+			build_events ();
+		};
+
+		// --- METHODS
+		void build_events (void);
 	};
 
 	/**
@@ -396,6 +657,40 @@ namespace gtfs {
 		RouteStop (std::shared_ptr<Stop> stop, double d) : stop (stop), shape_dist_traveled (d) {};
 	};
 
+	/**
+	 * A struct representing a point along a route at which a vehicle may stop:
+	 * either a bus stop, or an intersection (i.e., the start of a segment).
+	 *
+	 * Stops and intersections are merged into a single table so that
+	 * particles can move through them with one cursor.
+	 * The first stop and first segment are where the route begins,
+	 * so aren't included.
+	 */
+	struct RouteEvent {
+		double distance;     /*!< how far along the route the event is */
+		int type;            /*!< 0 = stop, 1 = intersection */
+		unsigned stop;       /*!< index of the most recent stop, once this event is passed */
+		unsigned segment;    /*!< index of the current segment, once this event is passed */
+
+		double pstop;        /*!< probability a vehicle stops (or is stopped) here */
+		double wait_min;     /*!< minimum time spent, if the vehicle stops */
+		double wait_mean;    /*!< mean of the (exponential) additional time spent, if the vehicle stops */
+
+		/**
+		 * Constructor for a RouteEvent.
+		 * @param d     distance along the route
+		 * @param type  0 = stop, 1 = intersection
+		 * @param index index of the stop or segment, respectively
+		 */
+		RouteEvent (double d, int type, unsigned index) :
+			distance (d), type (type),
+			stop (type == 0 ? index : 0), segment (type == 1 ? index : 0),
+			pstop (0), wait_min (0), wait_mean (0) {};
+
+		/** @return logical, if the event is a bus stop */
+		bool is_stop (void) const { return type == 0; };
+	};
+
 	/**
 	 * An object of this class represents a unique TRIP in the GTFS schedule.
 	 *
@@ -434,6 +729,47 @@ namespace gtfs {
 		}
 	};
 
+	/**
+	 * A lookup table for positions along a shape's path.
+	 *
+	 * Built once when the shape is loaded, the index stores the cumulative
+	 * distance of each vertex in a flat array, along with the vertices
+	 * projected onto a local plane and the (planar) bearing to the next vertex,
+	 * so a position can be found by binary search and a single multiply-add
+	 * instead of a linear scan and spherical trigonometry.
+	 */
+	class ShapeIndex {
+	private:
+		gps::Projection proj;      /*!< the local projection used for the shape */
+		std::vector<double> dist;  /*!< cumulative distance of each vertex */
+		std::vector<double> x;     /*!< projected vertex coordinates (meters east) */
+		std::vector<double> y;     /*!< projected vertex coordinates (meters north) */
+		std::vector<double> bx;    /*!< east displacement per meter traveled towards the next vertex */
+		std::vector<double> by;    /*!< north displacement per meter traveled towards the next vertex */
+		gps::Grid grid;            /*!< spatial index over the legs of the path */
+
+	public:
+		ShapeIndex () {};
+		ShapeIndex (const std::vector<ShapePt>& path);
+
+		// --- GETTERS
+		/** @return the number of vertices in the index */
+		unsigned size (void) const { return dist.size (); };
+		/** @return the projection used by the index */
+		const gps::Projection& get_projection (void) const { return proj; };
+
+		// --- METHODS
+		unsigned find (double distance) const;
+		void project (double distance, double& px, double& py) const;
+		void project (double distance, double& px, double& py,
+					  double& tx, double& ty) const;
+		gps::Coord get_coords (double distance) const;
+		void get_coords (const std::vector<double>& distances,
+						 std::vector<gps::Coord>& coords) const;
+		void near (const gps::Coord& p, double radius, std::vector<unsigned>& legs) const;
+		double snap (const gps::Coord& p, double radius) const;
+	};
+
 	/**
 	 * An object of this class represents the path a vehicles takes
 	 * from origin to destination.
@@ -447,6 +783,7 @@ namespace gtfs {
 		std::string id;
 		std::vector<ShapePt> path;
 		std::vector<ShapeSegment> segments;
+		ShapeIndex index;
 
 	public:
 		/**
@@ -460,7 +797,8 @@ namespace gtfs {
 		 * @param id   the ID of the shape
 		 * @param path the path, sequence of cooridinates, for the shape
 		 */
-		Shape (std::string& id, std::vector<ShapePt>& path) : id (id), path (path) {};
+		Shape (std::string& id, std::vector<ShapePt>& path) :
+			id (id), path (path), index (path) {};
 
 		/**
 		 * Constructor for a shape with path and segments.
@@ -469,7 +807,7 @@ namespace gtfs {
 		 * @param segments vector of segments making up the shape
 		 */
 		Shape (std::string& id, std::vector<ShapePt>& path, std::vector<ShapeSegment> segments) :
-			id (id), path (path), segments (segments) {};
+			id (id), path (path), segments (segments), index (path) {};
 
 		// --- GETTERS
 		/** @return the shape's ID */
@@ -481,6 +819,9 @@ namespace gtfs {
 		/** @return a vector of shape segments */
 		const std::vector<ShapeSegment>& get_segments (void) const { return segments; };
 
+		/** @return the distance index of the shape's path */
+		const ShapeIndex& get_index (void) const { return index; };
+
 		// --- SETTERS
 		void set_path (std::vector<ShapePt>& path);
 		void add_segment (std::shared_ptr<Segment> segment, double distance);
@@ -511,6 +852,60 @@ namespace gtfs {
 			: segment (segment), shape_dist_traveled (distance) {};
 	};
 
+	/**
+	 * Running sums of a segment's travel time observations.
+	 *
+	 * Vehicles add to them concurrently, as they finish the segment,
+	 * without locking; they are taken (and reset) once all vehicles are done.
+	 */
+	struct TravelTimeSums {
+		std::atomic<unsigned> n;       /*!< the number of observations */
+		std::atomic<double> sum;       /*!< the sum of the travel times */
+		std::atomic<double> sum2;      /*!< the sum of their squares */
+		std::atomic<double> sumvar;    /*!< the sum of their variances */
+
+		TravelTimeSums () : n (0), sum (0), sum2 (0), sumvar (0) {};
+		/** Copy the sums (not concurrently with adding to them) */
+		TravelTimeSums (const TravelTimeSums& x) :
+			n (x.n.load ()), sum (x.sum.load ()), sum2 (x.sum2.load ()), sumvar (x.sumvar.load ()) {};
+
+		/** @return the number of observations */
+		unsigned size (void) const { return n.load (std::memory_order_relaxed); };
+
+		/**
+		 * Add an observation.
+		 * @param t the travel time
+		 * @param v its variance
+		 */
+		void add (double t, double v) {
+			add (sum, t);
+			add (sum2, t * t);
+			add (sumvar, v);
+			n.fetch_add (1, std::memory_order_relaxed);
+		};
+
+		/** Add x to an atomic double */
+		static void add (std::atomic<double>& a, double x) {
+			double cur = a.load (std::memory_order_relaxed);
+			while (!a.compare_exchange_weak (cur, cur + x, std::memory_order_relaxed)) {}
+		};
+
+		/**
+		 * Take the observations' mean and variance (including each one's own),
+		 * and reset the sums.
+		 * @param  mean set to the mean
+		 * @param  var  set to the variance
+		 * @return      false if there are no observations
+		 */
+		bool take (double& mean, double& var) {
+			unsigned k = n.exchange (0);
+			if (k == 0) return false;
+			mean = sum.exchange (0) / k;
+			var = (sum2.exchange (0) + sumvar.exchange (0)) / k - mean * mean;
+			return true;
+		};
+	};
+
 	/**
 	 * An object of this class represents a vehicles path
 	 * between two intersections.
@@ -535,11 +930,13 @@ namespace gtfs {
 		double travel_time = 0;             /*!< the mean speed along the segment */
 		double travel_time_var = 0;         /*!< the variance of speed along the segment */
 		uint64_t timestamp = 0;             /*!< updated at timestamp */
+		unsigned long version = 0;          /*!< incremented when the estimate is initialised or updated with data */
+		const uint64_t* clock = nullptr;    /*!< the network's current time, which reads bring the estimate up to */
 
 		// double pred_tt = 0;        /*!< predicted travel time for next period */
 		// double pred_ttvar = 0;     /*!< variance of travel time for next period */
 
-		std::vector<std::tuple<int, double> > data; /*!< estimates of travel time for recent vehicles */
+		TravelTimeSums data;        /*!< estimates of travel time for recent vehicles */
 
 	public:
 		/**
@@ -609,19 +1006,64 @@ namespace gtfs {
 		/** @return logical, if the segment ends at an intersection */
 		bool toInt (void) { return type == 1 || type == 2; };
 
-		bool has_data (void) { return data.size () > 0; };
-		bool is_initialized (void) { return timestamp > 0; };
-        double get_travel_time (void) { return travel_time; };
-        double get_travel_time_var (void) { return travel_time_var; };
-        const uint64_t& get_timestamp (void) const { return timestamp; };
+		bool has_data (void) const { return data.size () > 0; };
+		bool is_initialized (void) { return get_timestamp () > 0; };
+        double get_travel_time (void) { catch_up (); return travel_time; };
+        double get_travel_time_var (void) { catch_up (); return travel_time_var; };
+        uint64_t get_timestamp (void) { catch_up (); return timestamp; };
+		/** @return the number of times the estimate has been initialised or updated with data */
+		unsigned long get_version (void) const { return version; };
 
 		// --- METHODS
 		void set_length (double len) { length = len; };
+		/** @param c the clock to follow (e.g., the network's), or nullptr for none */
+		void set_clock (const uint64_t* c) { clock = c; };
 		void add_data (int mean, double var);
+		bool take_data (double& mean, double& var);
+		void set_estimate (double mean, double var);
 		void predict (time_t t);
+		void catch_up (void);
 		void update ();
 	};
 
+	/**
+	 * The road network: which segments follow which (from the shapes),
+	 * so that an observation of one segment also updates its neighbours.
+	 *
+	 * Each cycle, the segments with new data and those within a few segments
+	 * of them are updated jointly, using an information filter with
+	 * adjacent segments' travel times correlated.
+	 */
+	class SegmentNetwork {
+	private:
+		std::vector<std::shared_ptr<Segment> > segments;   /*!< the segments in the network */
+		std::unordered_map<unsigned long, unsigned> index; /*!< segment ID -> position in segments */
+		std::vector<std::pair<unsigned, unsigned> > links; /*!< adjacent segments, as added */
+		std::vector<unsigned> adj_start; /*!< the neighbours of segment i are adj[adj_start[i]] to adj[adj_start[i+1] - 1] */
+		std::vector<unsigned> adj;       /*!< the neighbours of every segment */
+		bool built = false;              /*!< true if adj is up to date with links */
+
+		unsigned add (std::shared_ptr<Segment> sg);
+		void build (void);
+		void update (std::vector<unsigned>& nodes, int threads);
+
+	public:
+		double correlation = 0.5; /*!< the correlation between (an isolated pair of) adjacent segments; 0 updates segments independently */
+		unsigned hops = 2;        /*!< how many segments away an observation is shared */
+
+		SegmentNetwork () {};
+
+		// --- GETTERS
+		/** @return the number of segments in the network */
+		unsigned size (void) const { return segments.size (); };
+
+		// --- METHODS
+		void load (GTFS& gtfs);
+		void link (std::shared_ptr<Segment> from, std::shared_ptr<Segment> to);
+		unsigned update (void);
+		unsigned update (int threads);
+	};
+
 	/**
 	 * A struct describing a single shape point.
 	 */
@@ -710,22 +1152,25 @@ namespace gtfs {
 
 	/**
 	 * A struct representing an instance of a trip arriving at a stop.
+	 *
+	 * Times are stored as seconds since the start of the service day,
+	 * so may exceed 86400 for trips running past midnight.
 	 */
 	struct StopTime {
-		std::shared_ptr<Stop> stop;          /*!< pointer to the stop */
-		boost::posix_time::time_duration arrival_time;   /*!< the scheduled arrival time */
-		boost::posix_time::time_duration departure_time; /*!< the scheduled departure time */
-		bool layover;        /*!< if true, the stop is a layover and we assume
-	   				              the bus doesn't leave until the
-								  scheduled departure time */
+		Stop* stop;                /*!< handle to the stop (owned by the GTFS object) */
+		int32_t arrival_time;      /*!< the scheduled arrival time */
+		int32_t departure_time;    /*!< the scheduled departure time */
+		bool layover = false;      /*!< if true, the stop is a layover and we assume
+	   				                    the bus doesn't leave until the
+								        scheduled departure time */
 
 		/** Constructor for a StopTime struct */
-		StopTime (std::shared_ptr<Stop> stop,
-				  std::string& arrival,
-				  std::string& departure) : stop (stop) {
-			arrival_time = boost::posix_time::duration_from_string (arrival);
-			departure_time = boost::posix_time::duration_from_string (departure);
-		};
+		StopTime (Stop* stop,
+				  const char* arrival,
+				  const char* departure) :
+			stop (stop),
+			arrival_time (parse_time (arrival)),
+			departure_time (parse_time (departure)) {};
 	};
 
 
@@ -793,7 +1238,7 @@ namespace gtfs {
 
 		/** Give the data to the segment */
 		void use (void) {
-			segment->add_data (get_time (), var);
+			if (segment) segment->add_data (get_time (), var);
 		}
 	};
 
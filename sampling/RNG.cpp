@@ -1,5 +1,7 @@
 #include <random>
 #include <stdexcept>
+#include <algorithm>
+#include <math.h>
 
 #include <sampling.h>
 
@@ -8,10 +10,11 @@ namespace sampling {
 	/**
 	 * Default constructor.
 	 *
-	 * Initialises the generator with a standard uniform and
-	 * standard normal random number generator.
+	 * Initialises the generator and (empty) blocks of
+	 * uniform, standard normal and standard exponential variates.
 	 */
-	RNG::RNG () : uniform (0.0, 1.0), normal (0.0, 1.0) {};
+	RNG::RNG () : ubuf (block), zbuf (block), ebuf (block),
+	ui (block), zi (block), ei (block) {};
 
 	/**
 	 * Default constructor with seed.
@@ -26,33 +29,74 @@ namespace sampling {
 	// METHODS
 
 	/**
-	 * Set the RNG's seed.
+	 * Set the RNG's seed, discarding any variates already generated.
 	 * @param seed the seed to use
 	 */
 	void RNG::set_seed (unsigned int seed) {
 		gen.seed (seed);
+		ui = zi = ei = block;
 	};
 
 
 	// DISTRIBUTIONS
 
 	/**
-	 * Return a single U[0,1] random number
-	 * @return  a random number between 0 and 1
+	 * Fill an array with U(0,1) random numbers.
+	 *
+	 * The generator itself is sequential; the conversion of its output
+	 * to doubles (using the top 53 bits, offset by half a unit so neither
+	 * 0 nor 1 can occur) is done in a separate, vectorizable loop.
+	 *
+	 * @param x array to fill
+	 * @param n the number of values
 	 */
-	double RNG::runif (void) {
-		return uniform (gen);
+	void RNG::runif (double* x, unsigned n) {
+		uint64_t bits[block];
+		for (unsigned k=0; k<n; k+=block) {
+			unsigned m = n - k < block ? n - k : block;
+			for (unsigned i=0; i<m; i++) bits[i] = gen ();
+			double* xk = x + k;
+			#pragma omp simd
+			for (unsigned i=0; i<m; i++) {
+				xk[i] = ((bits[i] >> 11) + 0.5) / 9007199254740992.0; // 2^53
+			}
+		}
 	};
 
 	/**
-	 * Return a single N(0,1) random number
-	 * @return  a single standard-normal random number
+	 * Fill an array with N(0,1) random numbers.
+	 *
+	 * Uses the Box-Muller transform, which (unlike rejection methods)
+	 * has no branches so a block can be transformed in one loop.
+	 *
+	 * @param x array to fill
+	 * @param n the number of values
 	 */
-	double RNG::rnorm (void) {
-		return normal (gen);
+	void RNG::rnorm (double* x, unsigned n) {
+		const unsigned h = block / 2;
+		double u[block], z[block];
+		for (unsigned k=0; k<n; k+=block) {
+			runif (u, block);
+			#pragma omp simd
+			for (unsigned i=0; i<h; i++) {
+				double r = sqrt (-2.0 * log (u[i]));
+				double t = 2.0 * M_PI * u[i + h];
+				z[i] = r * cos (t);
+				z[i + h] = r * sin (t);
+			}
+			std::copy (z, z + (n - k < block ? n - k : block), x + k);
+		}
 	};
 
-
-
+	/**
+	 * Fill an array with Exp(1) random numbers.
+	 * @param x array to fill
+	 * @param n the number of values
+	 */
+	void RNG::rexp (double* x, unsigned n) {
+		runif (x, n);
+		#pragma omp simd
+		for (unsigned i=0; i<n; i++) x[i] = - log (x[i]);
+	};
 
 }; // end namespace sampling
@@ -44,7 +44,7 @@ namespace sampling {
 	 * @return     a random value
 	 */
 	double exponential::rand (sampling::RNG &rng) {
-		return - std::log (rng.runif ()) / lambda;
+		return rng.rexp () / lambda;
 	};
 
 }; // end namespace sampling
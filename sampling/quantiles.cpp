@@ -0,0 +1,62 @@
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <stdint.h>
+
+#include <sampling.h>
+
+namespace sampling {
+
+	template <typename T>
+	static void select_quantiles (std::vector<T>& x, const std::vector<double>& p,
+	                              std::vector<T>& q) {
+		if (x.size () == 0) {
+			throw std::invalid_argument ("x must not be empty");
+		}
+		size_t n (x.size ());
+		q.resize (p.size ());
+		auto lo = x.begin ();
+		for (unsigned i=0; i<p.size (); i++) {
+			if (p[i] < 0 || p[i] > 1 || (i > 0 && p[i] < p[i-1])) {
+				throw std::invalid_argument ("p must be increasing probabilities");
+			}
+			auto k = x.begin () + std::min ((size_t)(n * p[i]), n - 1);
+			// the same position as the last quantile is already in place
+			if (k >= lo) {
+				std::nth_element (lo, k, x.end ());
+				lo = k + 1;
+			}
+			q[i] = *k;
+		}
+	};
+
+	/**
+	 * Several quantiles of a set of values, by selection rather than sorting.
+	 *
+	 * The p-quantile is the value in position floor(n * p) of the sorted values.
+	 * Each is found with `nth_element` on the part of `x` above the previous one,
+	 * so the cost is linear in n (for a handful of quantiles) and,
+	 * once `q` is large enough, nothing is allocated.
+	 *
+	 * @param x the values; reordered, but not sorted
+	 * @param p the probabilities, in increasing order
+	 * @param q the quantiles, one for each of p
+	 */
+	void quantiles (std::vector<uint64_t>& x, const std::vector<double>& p,
+	                std::vector<uint64_t>& q) {
+		select_quantiles (x, p, q);
+	};
+
+	/**
+	 * Several quantiles of a set of (real) values; see above.
+	 *
+	 * @param x the values; reordered, but not sorted
+	 * @param p the probabilities, in increasing order
+	 * @param q the quantiles, one for each of p
+	 */
+	void quantiles (std::vector<double>& x, const std::vector<double>& p,
+	                std::vector<double>& q) {
+		select_quantiles (x, p, q);
+	};
+
+}; // end namespace sampling
@@ -1,5 +1,9 @@
 #include <random>
 #include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <math.h>
 
 #include <iostream>
 
@@ -23,13 +27,11 @@ namespace sampling {
 	 */
 	sample::sample (const std::vector<double> &wts)
 	: N (wts.size ()), weighted (true) {
-		weights.reserve (N);
-		double ws = 0.0;
-		for (int i=0; i<N; i++) {
-			if (wts[i] < 0) throw std::invalid_argument ("weights must be non-negative");
-			ws += wts[i];
-			weights[i] = ws;
+		for (auto& w: wts) {
+			if (w < 0) throw std::invalid_argument ("weights must be non-negative");
 		}
+		weights.resize (N);
+		std::partial_sum (wts.begin (), wts.end (), weights.begin ());
 	};
 
 
@@ -45,29 +47,114 @@ namespace sampling {
 	};
 
 	/**
-	 * Perform resampling, taking a sample of size `n`.
+	 * Perform (multinomial) resampling, taking a sample of size `n`.
 	 *
 	 * @param n   the size of the new sample
 	 * @param rng a random number generator
 	 * @return    a vector of sample indexes
 	 */
 	std::vector<int> sample::get (int n, RNG &rng) {
+		return get (n, rng, multinomial);
+	};
+
+	/**
+	 * Perform resampling, taking a sample of size `n` using the given scheme.
+	 *
+	 * Multinomial sampling takes O(n log N) time;
+	 * the other schemes take O(n + N).
+	 *
+	 * @param n    the size of the new sample
+	 * @param rng  a random number generator
+	 * @param type the resampling scheme to use
+	 * @return     a vector of sample indexes
+	 */
+	std::vector<int> sample::get (int n, RNG &rng, scheme type) {
 		std::vector<int> s;
+		if (n <= 0) return s;
 		s.reserve (n);
-		if (weighted) {
-			// perform weighted resampling
-			for (int i=0; i<n; i++) {
-				int j=0;
-				auto u = rng.runif () * weights[N-1];
-				while (weights[j] < u) j++;
-				s.push_back (j);
-			}
-		} else {
-			// perform non-weighted
-			for (int i=0; i<n; i++) {
-				s.push_back (floor(rng.runif () * N));
-			}
+
+		double W = cumulative (N - 1);
+		std::vector<double> u;
+		switch (type) {
+			case multinomial:
+				if (weighted) {
+					for (int i=0; i<n; i++) {
+						auto x = rng.runif () * W;
+						s.push_back (std::lower_bound (weights.begin (), weights.end (), x) - weights.begin ());
+					}
+				} else {
+					// perform non-weighted
+					for (int i=0; i<n; i++) {
+						s.push_back (floor(rng.runif () * N));
+					}
+				}
+				break;
+
+			case systematic:
+				u.resize (n);
+				{
+					double u0 = rng.runif ();
+					for (int i=0; i<n; i++) u[i] = (i + u0) * W / n;
+				}
+				get_sorted (u, s);
+				break;
+
+			case stratified:
+				u.resize (n);
+				for (int i=0; i<n; i++) u[i] = (i + rng.runif ()) * W / n;
+				get_sorted (u, s);
+				break;
+
+			case residual:
+				if (W <= 0) return get (n, rng, stratified);
+				{
+					// deterministic copies, then sample the remainder
+					std::vector<double> r (N);
+					double wprev = 0.0;
+					for (int j=0; j<N; j++) {
+						double e = n * (cumulative (j) - wprev) / W;
+						wprev = cumulative (j);
+						int k = floor (e);
+						r[j] = e - k;
+						for (; k > 0 && (int)s.size () < n; k--) s.push_back (j);
+					}
+					int m = n - s.size ();
+					if (m > 0) {
+						auto rest = sample (r).get (m, rng, stratified);
+						s.insert (s.end (), rest.begin (), rest.end ());
+					}
+				}
+				break;
 		}
 		return s;
 	};
+
+	/**
+	 * Find the index of each of an increasing sequence of points
+	 * in the cumulative weights, in a single pass.
+	 *
+	 * @param u points in [0, W], in increasing order
+	 * @param s vector to which the indexes are appended
+	 */
+	void sample::get_sorted (const std::vector<double>& u, std::vector<int>& s) const {
+		int j = 0;
+		for (auto& x: u) {
+			while (j < N-1 && cumulative (j) <= x) j++;
+			s.push_back (j);
+		}
+	};
+
+	/**
+	 * Look up a resampling scheme by name.
+	 *
+	 * @param  name one of "multinomial", "systematic", "stratified" or "residual"
+	 * @return      the scheme
+	 */
+	scheme get_scheme (const std::string& name) {
+		if (name == "multinomial") return multinomial;
+		if (name == "systematic") return systematic;
+		if (name == "stratified") return stratified;
+		if (name == "residual") return residual;
+		throw std::invalid_argument ("unknown resampling scheme: " + name);
+	};
 }; // end namespace sampling
@@ -2,7 +2,9 @@
 #define SAMPLING_H value
 
 #include <random>
+#include <string>
 #include <vector>
+#include <stdint.h>
 
 /**
  * All sampling functionality contained in `samping::`.
@@ -11,15 +13,21 @@ namespace sampling {
 	/**
 	 * Random Number Generator
 	 *
-	 * Ideally one per program, passed by reference.
+	 * Ideally one per thread, passed by reference.
 	 *
+	 * Variates are generated in blocks (which can be vectorized),
+	 * and single draws are served from those blocks.
 	 */
 	class RNG {
 	private:
+		static const unsigned block = 256; /*!< number of variates generated at once */
+
 		std::mt19937_64 gen;
 
-		std::uniform_real_distribution<double> uniform;
-		std::normal_distribution<double> normal;
+		std::vector<double> ubuf;  /*!< block of U(0,1) variates */
+		std::vector<double> zbuf;  /*!< block of N(0,1) variates */
+		std::vector<double> ebuf;  /*!< block of Exp(1) variates */
+		unsigned ui, zi, ei;       /*!< index of the next unused variate in each block */
 
 	public:
 		// Constructors
@@ -30,9 +38,26 @@ namespace sampling {
 		void set_seed (unsigned int seed);
 
 		// Distributions
-		double runif (void);
-
-		double rnorm (void);
+		/** @return a single U(0,1) random number */
+		double runif (void) {
+			if (ui == block) { runif (ubuf.data (), block); ui = 0; }
+			return ubuf[ui++];
+		};
+		/** @return a single N(0,1) random number */
+		double rnorm (void) {
+			if (zi == block) { rnorm (zbuf.data (), block); zi = 0; }
+			return zbuf[zi++];
+		};
+		/** @return a single Exp(1) random number */
+		double rexp (void) {
+			if (ei == block) { rexp (ebuf.data (), block); ei = 0; }
+			return ebuf[ei++];
+		};
+
+		// Blocks
+		void runif (double* x, unsigned n);
+		void rnorm (double* x, unsigned n);
+		void rexp (double* x, unsigned n);
 	};
 
 	/**
@@ -76,6 +101,40 @@ namespace sampling {
 	};
 
 
+	/**
+	 * Class used for Normal distributions truncated to [a, b].
+	 *
+	 * (Log) PDF and random variables; sampling is by inversion,
+	 * so each draw uses exactly one uniform.
+	 */
+	class truncated_normal {
+	private:
+		double mu,     /*!< mean of the untruncated distribution */
+		       sigma,  /*!< standard deviation of the untruncated distribution */
+		       a,      /*!< lower bound */
+		       b;      /*!< upper bound */
+		bool flip;     /*!< if true, sample from the lower tail of the mirrored distribution */
+		double pa,     /*!< CDF (of the standardised, possibly mirrored, distribution) at the lower bound */
+		       pb;     /*!< CDF at the upper bound */
+
+	public:
+		truncated_normal (double mu, double sigma, double a, double b);
+
+		double pdf (double x);
+		double pdf_log (double x);
+
+		/** @return the probability that the untruncated distribution lies in [a, b] */
+		double get_mass (void) const { return pb - pa; };
+		double quantile (double u) const;
+
+		double rand (sampling::RNG &rng);
+		void rand (sampling::RNG &rng, double* x, unsigned n);
+	};
+
+	double pnorm (double x);
+	double qnorm (double p);
+
+
 	/**
 	 * Class used for Exponential distributions.
 	 *
@@ -96,6 +155,24 @@ namespace sampling {
 	};
 
 
+	void quantiles (std::vector<uint64_t>& x, const std::vector<double>& p,
+	                std::vector<uint64_t>& q);
+	void quantiles (std::vector<double>& x, const std::vector<double>& p,
+	                std::vector<double>& q);
+
+
+	/**
+	 * Resampling schemes.
+	 *
+	 * - multinomial: n independent draws (binary search of the cumulative weights)
+	 * - systematic: one uniform draw, n evenly spaced points
+	 * - stratified: one uniform draw in each of n equal strata
+	 * - residual: floor(n * w) copies of each, the remainder stratified
+	 */
+	enum scheme { multinomial, systematic, stratified, residual };
+
+	scheme get_scheme (const std::string& name);
+
 	/**
 	 * A class for taking a random (weighted) sample.
 	 *
@@ -108,7 +185,10 @@ namespace sampling {
 	private:
 		int N; /*!< the number of objects in the sample */
 		bool weighted;  /*!< whether or not the sample is weighted or not */
-		std::vector<double> weights; /*!< sampling weights */
+		std::vector<double> weights; /*!< cumulative sampling weights */
+
+		double cumulative (int j) const { return weighted ? weights[j] : j + 1; };
+		void get_sorted (const std::vector<double>& u, std::vector<int>& s) const;
 
 	public:
 		sample (int N);
@@ -116,6 +196,7 @@ namespace sampling {
 
 		std::vector<int> get (sampling::RNG &rng);
 		std::vector<int> get (int n, sampling::RNG &rng);
+		std::vector<int> get (int n, sampling::RNG &rng, scheme type);
 	};
 };
 
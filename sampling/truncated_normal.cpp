@@ -0,0 +1,146 @@
+#include <math.h>
+#include <random>
+#include <stdexcept>
+
+#include <sampling.h>
+
+namespace sampling {
+
+	/**
+	 * Constructor for a normal N(mu, sigma^2) truncated to [a, b].
+	 *
+	 * Intervals entirely above the mean are handled by mirroring,
+	 * so the CDF is always evaluated in the lower tail, where it is accurate.
+	 */
+	truncated_normal::truncated_normal (double mu, double sigma, double a, double b) :
+	mu (mu), sigma (sigma), a (a), b (b) {
+		if (sigma <= 0) {
+			throw std::invalid_argument ("sigma must be positive");
+		}
+		if (a > b) {
+			throw std::invalid_argument ("a must be less than or equal to b");
+		}
+		double alpha = (a - mu) / sigma,
+		       beta = (b - mu) / sigma;
+		flip = alpha > 0;
+		pa = pnorm (flip ? -beta : alpha);
+		pb = pnorm (flip ? -alpha : beta);
+	};
+
+	/**
+	 * Computes the PDF for a given value of x
+	 * @param  x the x value to evaluate
+	 * @return   the probability density function at x
+	 */
+	double truncated_normal::pdf (double x) {
+		return std::exp (truncated_normal::pdf_log (x));
+	};
+
+	/**
+	 * Returns the log PDF for a given x
+	 * @param  x   x value to evaluate
+	 * @return     log probability density at x
+	 */
+	double truncated_normal::pdf_log (double x) {
+		if (x < a || x > b) return -INFINITY;
+		return - 0.5 * std::log (2 * M_PI) - std::log (sigma) -
+			pow(x - mu, 2) / (2 * pow(sigma, 2)) - std::log (pb - pa);
+	};
+
+	/**
+	 * The quantile function.
+	 *
+	 * If the interval is so far into the tail that its probability
+	 * underflows, the bound closest to the mean is returned.
+	 *
+	 * @param  u a probability
+	 * @return   x such that P(X <= x) = u
+	 */
+	double truncated_normal::quantile (double u) const {
+		if (a == b || pb <= pa) return flip ? a : b;
+		double z = qnorm (pa + (flip ? 1 - u : u) * (pb - pa));
+		double x = mu + (flip ? -z : z) * sigma;
+		// guard against rounding at the bounds
+		return fmin (fmax (x, a), b);
+	};
+
+	/**
+	 * Sample a random observation from the given truncated normal distribution
+	 * @param  rng reference to a RNG
+	 * @return     a random value
+	 */
+	double truncated_normal::rand (sampling::RNG &rng) {
+		return quantile (rng.runif ());
+	};
+
+	/**
+	 * Sample several random observations from the distribution.
+	 * @param rng reference to a RNG
+	 * @param x   array to fill
+	 * @param n   the number of values
+	 */
+	void truncated_normal::rand (sampling::RNG &rng, double* x, unsigned n) {
+		rng.runif (x, n);
+		for (unsigned i=0; i<n; i++) x[i] = quantile (x[i]);
+	};
+
+
+	/**
+	 * The standard normal CDF.
+	 * @param  x the value to evaluate
+	 * @return   P(Z <= x)
+	 */
+	double pnorm (double x) {
+		return 0.5 * std::erfc (- x / M_SQRT2);
+	};
+
+	/**
+	 * The standard normal quantile function.
+	 *
+	 * Uses Acklam's rational approximation (relative error 1.15e-9),
+	 * refined with one step of Halley's method to full double precision.
+	 *
+	 * @param  p a probability
+	 * @return   x such that P(Z <= x) = p
+	 */
+	double qnorm (double p) {
+		if (p <= 0) return -INFINITY;
+		if (p >= 1) return INFINITY;
+
+		static const double
+			a[] = {-3.969683028665376e+01,  2.209460984245205e+02,
+			       -2.759285104469687e+02,  1.383577518672690e+02,
+			       -3.066479806614716e+01,  2.506628277459239e+00},
+			b[] = {-5.447609879822406e+01,  1.615858368580409e+02,
+			       -1.556989798598866e+02,  6.680131188771972e+01,
+			       -1.328068155288572e+01},
+			c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+			       -2.400758277161838e+00, -2.549732539343734e+00,
+			        4.374664141464968e+00,  2.938163982698783e+00},
+			d[] = { 7.784695709041462e-03,  3.224671290700398e-01,
+			        2.445134137142996e+00,  3.754408661907416e+00};
+		const double plow = 0.02425;
+
+		double x, q, r;
+		if (p < plow) {
+			q = sqrt (-2 * log (p));
+			x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+				((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+		} else if (p <= 1 - plow) {
+			q = p - 0.5;
+			r = q * q;
+			x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+				(((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+		} else {
+			q = sqrt (-2 * log (1 - p));
+			x = - (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+				((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+		}
+
+		// Halley step
+		double e = pnorm (x) - p;
+		double u = e * sqrt (2 * M_PI) * exp (x * x / 2);
+		return x - u / (1 + x * u / 2);
+	};
+
+}; // end namespace sampling
@@ -1016,13 +1016,28 @@ std::vector<Split> find_intersections (std::shared_ptr<gtfs::Shape> shape,
 		if (pt.lng > lngmax) lngmax = pt.lng;
 	}
 
+	// Index the legs of the shape so each intersection is only compared
+	// to the legs that pass nearby
+	gps::Grid grid (shapepts, 40.0);
+	std::vector<unsigned> legs;
+	std::vector<std::vector<gtfs::Intersection*> > legints (shapepts.size ());
+
 	std::vector<gtfs::Intersection*> ikeep;
 	for (auto& it: intersections) {
 		auto pt = it.get_pos ();
 		if (pt.lat > latmin && pt.lat < latmax &&
 			pt.lng > lngmin && pt.lng < lngmax) {
-			auto np = pt.nearestPoint (shapepts);
-			if (np.d < 40) ikeep.push_back (&it);
+			grid.query (pt, 40.0, legs);
+			bool keep = false;
+			for (auto l: legs) {
+				if (l + 1 >= shapepts.size ()) continue;
+				std::vector<gps::Coord> pseg {shapepts[l], shapepts[l+1]};
+				if (pt.nearestPoint (pseg).d < 40) {
+					keep = true;
+					legints[l+1].push_back (&it);
+				}
+			}
+			if (keep) ikeep.push_back (&it);
 		}
 	}
 	// std::cout << " -> found " << ikeep.size () << " intersections.";
@@ -1041,7 +1056,7 @@ std::vector<Split> find_intersections (std::shared_ptr<gtfs::Shape> shape,
 		std::vector<gps::Coord> pseg {p1, p2};
 		double closest = 100;
 		int cid = -1;
-		for (auto it: ikeep) { // ikeep is a vector of Intersection* objects
+		for (auto it: legints[i]) { // intersections within 40m of this leg
 			auto pt = it->get_pos ();
 			auto np = pt.nearestPoint (pseg);
 			if (np.d < 40 && np.d < closest) {
@@ -31,6 +31,7 @@
 #include <chrono>
 #include <ctime>
 #include <thread>
+#include <omp.h>
 
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -46,9 +47,12 @@
 namespace po = boost::program_options;
 
 bool load_feed (std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> > &vs,
-				std::string &feed_file, int N, sampling::RNG &rng,
-				gtfs::GTFS &gtfs, time_t *filetime);
-// bool write_etas (std::unique_ptr<gtfs::Vehicle>& v, std::string &eta_file);
+				std::string &feed_file, int N, int window, sampling::scheme resampler, bool rbpf,
+				bool analytic, sampling::RNG &rng, gtfs::GTFS &gtfs, time_t *filetime);
+void write_etas (gtfs::Vehicle& v, transit_etas::Trip* trip,
+				 std::vector<uint64_t>& etas, std::vector<uint64_t>& q);
+bool split_vehicles (std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> > &vs,
+					 int numcore);
 void time_start (std::clock_t& clock, std::chrono::high_resolution_clock::time_point& wall);
 void time_end (std::clock_t& clock, std::chrono::high_resolution_clock::time_point& wall);
 
@@ -76,6 +80,16 @@ int main (int argc, char* argv[]) {
 	// std::string version;
 	/** number of particles per vehicle */
 	int N;
+	/** seconds of trajectory kept by each particle */
+	int window;
+	/** resampling scheme */
+	std::string resample;
+	/** Rao-Blackwellised particle filter (1) or not (0) */
+	int rbpf;
+	/** ETA engine */
+	std::string eta;
+	/** correlation between adjacent segments */
+	double correlation;
 	/** number of cores to use */
 	int numcore;
 
@@ -87,6 +101,11 @@ int main (int argc, char* argv[]) {
 		("database", po::value<std::string>(&dbname)->default_value("../gtfs.db"), "Database Connection to use.")
 		// ("version", po::value<std::string>(&version), "Version number to pull subset from database.")
 		("N", po::value<int>(&N)->default_value(1000), "Number of particles to initialize each vehicle.")
+		("window", po::value<int>(&window)->default_value(300), "Seconds of trajectory history each particle keeps; at least 62, since particles project about 60 seconds past the latest observation.")
+		("resample", po::value<std::string>(&resample)->default_value("multinomial"), "Resampling scheme: multinomial, systematic, stratified or residual.")
+		("rbpf", po::value<int>(&rbpf)->default_value(0), "Setting to 1 marginalises particle speeds with a Kalman filter (Rao-Blackwellised), so far fewer particles (--N) are needed.")
+		("eta", po::value<std::string>(&eta)->default_value("sample"), "ETA engine: sample (simulate each particle's arrival times) or analytic (combine the segments' travel time distributions, without simulating).")
+		("correlation", po::value<double>(&correlation)->default_value(0.5), "Correlation between adjacent segments' travel times, so data from one segment also updates its neighbours; 0 updates each segment independently.")
 		("numcore", po::value<int>(&numcore)->default_value(1), "Number of cores to use.")
 		("csv", po::value<int>(&csvout)->default_value(0), "Setting to 1 will cause all particles and their ETAs to be written to PARTICLES.csv and ETAs.csv, respectively; 2 will do the same but append to the file. WARNING: slow!")
 		("help", "Print this message and exit.")
@@ -110,6 +129,26 @@ int main (int argc, char* argv[]) {
 	    std::cerr << "No database specified. Use --database to select a SQLIte database.\n";
 		return -1;
 	}
+	sampling::scheme resampler;
+	try {
+		resampler = sampling::get_scheme (resample);
+	} catch (const std::invalid_argument& e) {
+		std::cerr << e.what () << "\n";
+		return -1;
+	}
+	if (eta != "sample" && eta != "analytic") {
+		std::cerr << "Unknown ETA engine: " << eta << "\n";
+		return -1;
+	}
+	if (correlation < 0 || correlation >= 1) {
+		std::cerr << "correlation must be in [0, 1)\n";
+		return -1;
+	}
+	if (window < 62) {
+		std::cerr << "window must be at least 62 seconds\n";
+		return -1;
+	}
+
 	// if (!vm.count ("version")) {
 	// 	std::cout << "WARNING: version number not specified; entire database will be loaded!\n";
 	// 	version = "";
@@ -121,12 +160,19 @@ int main (int argc, char* argv[]) {
 	// Load the global GTFS database object:
 	time_start (clockstart, wallstart);
 	gtfs::GTFS gtfs (dbname);
+	// which segments follow which, so neighbours can share data
+	gtfs::SegmentNetwork network;
+	network.correlation = correlation;
+	network.load (gtfs);
 	std::cout << " * Database loaded into memory\n";
 	time_end (clockstart, wallstart);
 
 	// An ordered map of vehicles that can be accessed using ["vehicle_id"]
 	std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> > vehicles;
 	sampling::RNG rng;
+	// one generator per thread (they buffer variates, so cannot be shared)
+	std::vector<sampling::RNG> rngs;
+	for (int i=0; i<std::max (numcore, 1); i++) rngs.emplace_back (i + 1);
 	bool forever = true;
 
 	std::ofstream f; // file for particles
@@ -139,6 +185,14 @@ int main (int argc, char* argv[]) {
     f2 << "segment_id,timestamp,travel_time,var,length\n";
 	f2.close ();
 
+	// the ETA feed is built on an arena, reused every cycle,
+	// and written out in the background while the next cycle runs
+	google::protobuf::Arena eta_arena;
+	std::thread eta_writer;
+	// each thread's buffers for summarising ETAs
+	std::vector<std::vector<uint64_t> > eta_buf (std::max (numcore, 1)),
+		eta_q (std::max (numcore, 1));
+
 	time_t curtime;
 	int repi = 20;
 	while (forever && repi > 0) {
@@ -153,7 +207,7 @@ int main (int argc, char* argv[]) {
 
 			for (auto file: files) {
 				try {
-					if ( ! load_feed (vehicles, file, N, rng, gtfs, &curtime) ) {
+					if ( ! load_feed (vehicles, file, N, window, resampler, rbpf == 1, eta == "analytic", rng, gtfs, &curtime) ) {
 						std::cerr << "\n x Unable to read file.\n";
 						continue;
 					}
@@ -175,17 +229,9 @@ int main (int argc, char* argv[]) {
 			continue;
 		}
 
-		{
-			// Update the the network state: step 1 - predict
-			time_start (clockstart, wallstart);
-			std::cout << "\n * Predicting latest network state ";
-			std::cout.flush ();
-
-			for (auto& s: gtfs.get_segments ()) s.second->predict (curtime);
-
-			std::cout << "\n";
-			time_end (clockstart, wallstart);
-		}
+		// Update the the network state: step 1 - predict
+		// (segments are brought forward lazily, when they are next read)
+		gtfs.set_time (curtime);
 
 		// Update each vehicle's particles
 		{
@@ -200,7 +246,9 @@ int main (int argc, char* argv[]) {
 			printf("at %s ...", buff);
 			std::cout << "\n";
 			std::cout.flush ();
-			#pragma omp parallel for schedule(dynamic, 20) num_threads(numcore)
+			bool intra = split_vehicles (vehicles, numcore);
+			if (intra) std::cout << " (splitting particles between cores)\n";
+			#pragma omp parallel for schedule(dynamic, 20) num_threads(numcore) if(!intra)
 			for (unsigned i=0; i<vehicles.bucket_count (); i++) {
 				for (auto v = vehicles.begin (i); v != vehicles.end (i); v++) {
 					if (v->second->is_finished ()) continue;
@@ -212,7 +260,8 @@ int main (int argc, char* argv[]) {
 							<< " [" << v->second->get_id () << "]";
 						std::cout.flush ();
 						try {
-							v->second->update (rng);
+							if (intra) v->second->update (rngs);
+							else v->second->update (rngs[omp_get_thread_num ()]);
 						} catch (const std::bad_alloc& e) {
 							std::clog << "\n *** ERROR: " << e.what () << " - out of memory?\n";
 							std::clog << "\n >> resetting :(\n\n";
@@ -232,38 +281,27 @@ int main (int argc, char* argv[]) {
 			time_start (clockstart, wallstart);
 			std::cout << "\n * Updating road network with latest travel times ...";
 			std::cout.flush ();
-			// loop over VEHICLES that were updated this iteration (?)
+			// (vehicles gave their travel times to the segments as they finished them:
+			// only log them here)
 			f.open ("segment_data.csv", std::ofstream::app);
 			for (auto& v: vehicles) {
-				auto t = v.second->get_trip ();
-				if (!t) continue;
-				auto r = t->get_route ();
-				if (!r) continue;
-				auto sh = r->get_shape ();
-				if (!sh) continue;
-				auto sgs = sh->get_segments ();
-				if (sgs.size () == 0) continue;
-				int L = v.second->get_travel_times ().size ();
-				for (int l=0; l<L; l++) {
+				for (auto l: v.second->get_new_travel_times ()) {
 					gtfs::TravelTime* tt = v.second->get_travel_time (l);
-					if (tt->time > 0 && tt->complete && !tt->used) {
-						f << tt->segment->get_id ()
-							<< "," << v.second->get_id ()
-							<< "," << curtime 
-							<< "," << tt->time
-							<< "," << tt->segment->get_length () << "\n";
-						tt->use ();
-					}
+					f << tt->segment->get_id ()
+						<< "," << v.second->get_id ()
+						<< "," << curtime 
+						<< "," << tt->time
+						<< "," << tt->segment->get_length () << "\n";
 				}
 			}
 			f.close ();
 
-			// Update segments and write to protocol buffer
+			// Update segments (and their neighbours) and write to protocol buffer
+			// (reading a segment predicts it, if its state is older than curtime)
+			network.update (numcore);
 			transit_network::Feed feed;
 			f2.open ("segment_state.csv", std::ofstream::app);
 			for (auto& s: gtfs.get_segments ()) {
-				if (s.second->has_data ()) s.second->update ();
-
 				f2 << s.second->get_id ()
 					<< "," << s.second->get_timestamp () 
 					<< "," << s.second->get_travel_time ()
@@ -322,12 +360,14 @@ int main (int argc, char* argv[]) {
 			time_start (clockstart, wallstart);
 			std::cout << "\n * Calculating ETAs ...";
 			std::cout.flush ();
-			#pragma omp parallel for schedule(dynamic, 20) num_threads(numcore)
+			bool intra = split_vehicles (vehicles, numcore);
+			#pragma omp parallel for schedule(dynamic, 20) num_threads(numcore) if(!intra)
 			for (unsigned i=0; i<vehicles.bucket_count (); i++) {
 				for (auto v = vehicles.begin (i); v != vehicles.end (i); v++) {
 					if (!v->second->get_trip () || v->second->is_finished ()) 
 						continue;
-					for (auto& p: v->second->get_particles ()) p.calculate_etas (rng);
+					if (intra) v->second->calculate_etas (rngs);
+					else v->second->calculate_etas (rngs[omp_get_thread_num ()]);
 					// std::clog << "\n ++++++++++ VEHICLE: " << v.second->get_id ();
 					// v.second->get_particles ()[0].calculate_etas (rng);
 				}
@@ -394,67 +434,33 @@ int main (int argc, char* argv[]) {
 			time_start (clockstart, wallstart);
 			std::cout << "\n * Writing ETAs to protocol buffer ...";
 			std::cout.flush ();
-			
-			transit_etas::Feed feed;
-			
+
+			// the last feed must be written before its arena can be reused
+			if (eta_writer.joinable ()) eta_writer.join ();
+			eta_arena.Reset ();
+			transit_etas::Feed* feed =
+				google::protobuf::Arena::CreateMessage<transit_etas::Feed> (&eta_arena);
+
+			std::vector<gtfs::Vehicle*> active;
 			for (auto& v: vehicles) {
 				if (!v.second->get_trip () || v.second->is_finished ()) continue;
-				transit_etas::Trip* trip = feed.add_trips ();
-				trip->set_vehicle_id (v.second->get_id ().c_str ());
-				trip->set_trip_id (v.second->get_trip ()->get_id ().c_str ());
-				trip->set_route_id (v.second->get_trip ()->get_route ()->get_id ().c_str ());
-				if (v.second->get_delay ()) trip->set_delay (v.second->get_delay ().get ());
-				double dist = 0, speed = 0;
-				for (auto& p: v.second->get_particles ()) {
-					dist += p.get_distance ();
-					speed += p.get_velocity ();
-				}
-				trip->set_distance_into_trip (dist / v.second->get_particles ().size ());
-				trip->set_velocity (speed / v.second->get_particles ().size ());
-			
-				// Initialize a vector of ETAs for each particles; stop by stop
-				unsigned Np (v.second->get_particles ().size ());
-				std::vector<uint64_t> etas;
-				etas.reserve (Np);
-			
-				auto stops = v.second->get_trip ()->get_stoptimes ();
-				for (unsigned j=0; j<stops.size (); j++) {
-					// For each stop, fetch ETAs for that stop
-					double cert = 0;
-					for (auto& p: v.second->get_particles ()) {
-						if (p.get_etas ().size () != stops.size () ||
-							p.get_eta (j) == 0 || 
-							p.is_finished ()) continue;
-						etas.push_back (p.get_eta (j));
-						cert += p.get_cert (j);
-					}
-					cert /= etas.size ();
-					if (etas.size () == 0) continue;
-					// order them to get percentiles: 0.025, 0.5, 0.975
-					std::sort (etas.begin (), etas.end ());
-			
-					// append to tripetas
-					transit_etas::Trip::ETA* tripetas = trip->add_etas ();
-					tripetas->set_stop_sequence (j+1);
-					tripetas->set_stop_id (stops[j].stop->get_id ().c_str ());
-					tripetas->set_arrival_min (etas[(int)(etas.size () * 0.025)]);
-					tripetas->set_arrival_max (etas[(int)(etas.size () * 0.975)]);
-					tripetas->set_arrival_eta (etas[(int)(etas.size () * 0.5)]);
-					tripetas->set_certainty (cert);
-			
-					// clear for next stop
-					etas.clear ();
-				}
+				active.push_back (v.second.get ());
+				feed->add_trips ();
 			}
-			
-			std::fstream output ("gtfs_etas.pb",
-								 std::ios::out | std::ios::trunc | std::ios::binary);
-			if (!feed.SerializeToOstream (&output)) {
-				std::cerr << "\n x Failed to write ETA feed.\n";
+			#pragma omp parallel for schedule(dynamic, 20) num_threads(numcore)
+			for (unsigned i=0; i<active.size (); i++) {
+				int th = omp_get_thread_num ();
+				write_etas (*active[i], feed->mutable_trips (i), eta_buf[th], eta_q[th]);
 			}
-			
-			google::protobuf::ShutdownProtobufLibrary ();
-			
+
+			eta_writer = std::thread ([feed] {
+				std::fstream output ("gtfs_etas.pb",
+									 std::ios::out | std::ios::trunc | std::ios::binary);
+				if (!feed->SerializeToOstream (&output)) {
+					std::cerr << "\n x Failed to write ETA feed.\n";
+				}
+			});
+
 			std::cout << "\n";
 			time_end (clockstart, wallstart);
 		}
@@ -463,6 +469,9 @@ int main (int argc, char* argv[]) {
 		if (forever) std::this_thread::sleep_for (std::chrono::milliseconds (5 * 1000));
 	}
 
+	if (eta_writer.joinable ()) eta_writer.join ();
+	google::protobuf::ShutdownProtobufLibrary ();
+
 	return 0;
 }
 
@@ -473,14 +482,18 @@ int main (int argc, char* argv[]) {
  * @param vs        reference to vector of vehicle pointers
  * @param feed_file reference to feed
  * @param N         the number of particle to initialze new vehicles with
+ * @param window    the number of seconds of trajectory new vehicles' particles keep
+ * @param resampler the resampling scheme new vehicles use
+ * @param rbpf      if true, new vehicles marginalise particle speeds (Rao-Blackwellised)
+ * @param analytic  if true, new vehicles compute ETAs analytically
  * @param rng       reference to a random number generator
  * @param gtfs      A GTFS object containing the static data
  * @param t         pointer to the "current" time ...
  * @return          true if the feed is loaded correctly, false if it is not
  */
 bool load_feed (std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> > &vs,
-				std::string &feed_file, int N, sampling::RNG &rng,
-				gtfs::GTFS &gtfs, time_t *filetime) {
+				std::string &feed_file, int N, int window, sampling::scheme resampler, bool rbpf,
+				bool analytic, sampling::RNG &rng, gtfs::GTFS &gtfs, time_t *filetime) {
 	transit_realtime::FeedMessage feed;
 	std::cout << "Checking for vehicle updates in feed: " << feed_file << " ... ";
 	std::fstream feed_in (feed_file, std::ios::in | std::ios::binary);
@@ -554,7 +567,10 @@ bool load_feed (std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> >
 		}
 		if (vs.find (vid) == vs.end ()) {
 			// vehicle doesn't already exist - create it
-			vs.emplace (vid, std::unique_ptr<gtfs::Vehicle> (new gtfs::Vehicle (vid, N)));
+			vs.emplace (vid, std::unique_ptr<gtfs::Vehicle> (new gtfs::Vehicle (vid, N, window)));
+			vs[vid]->resampler = resampler;
+			vs[vid]->rao_blackwell = rbpf;
+			vs[vid]->analytic_etas = analytic;
 		}
 		if (ent.has_vehicle ()) vs[vid]->update (ent.vehicle (), gtfs);
 		if (ent.has_trip_update ()) vs[vid]->update (ent.trip_update (), gtfs);
@@ -566,6 +582,98 @@ bool load_feed (std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> >
 	return true;
 }
 
+/**
+ * Summarise a vehicle's ETAs (its particles', or analytic) into its trip's ETA message.
+ *
+ * Vehicles can be written concurrently, each into its own message,
+ * as long as each thread has its own buffers.
+ *
+ * @param v    the vehicle
+ * @param trip the message to fill
+ * @param etas buffer for one stop's particle ETAs
+ * @param q    buffer for the quantiles of those ETAs
+ */
+void write_etas (gtfs::Vehicle& v, transit_etas::Trip* trip,
+				 std::vector<uint64_t>& etas, std::vector<uint64_t>& q) {
+	static const std::vector<double> probs {0.025, 0.5, 0.975};
+	auto& particles = v.get_particles ();
+	trip->set_vehicle_id (v.get_id ());
+	trip->set_trip_id (v.get_trip ()->get_id ());
+	trip->set_route_id (v.get_trip ()->get_route ()->get_id ());
+	if (v.get_delay ()) trip->set_delay (v.get_delay ().get ());
+	double dist = 0, speed = 0;
+	for (auto& p: particles) {
+		dist += p.get_distance ();
+		speed += p.get_velocity ();
+	}
+	trip->set_distance_into_trip (dist / particles.size ());
+	trip->set_velocity (speed / particles.size ());
+
+	auto& stops = v.get_trip ()->get_stoptimes ();
+	if (v.analytic_etas) {
+		auto& intervals = v.get_eta_intervals ();
+		for (unsigned j=0; j<stops.size () && j<intervals.size (); j++) {
+			if (intervals[j].median == 0) continue;
+			transit_etas::Trip::ETA* tripetas = trip->add_etas ();
+			tripetas->set_stop_sequence (j+1);
+			tripetas->set_stop_id (stops[j].stop->get_id ());
+			tripetas->set_arrival_min (intervals[j].lower);
+			tripetas->set_arrival_max (intervals[j].upper);
+			tripetas->set_arrival_eta (intervals[j].median);
+			tripetas->set_certainty (intervals[j].cert);
+		}
+		return;
+	}
+
+	etas.reserve (particles.size ());
+	for (unsigned j=0; j<stops.size (); j++) {
+		// For each stop, fetch ETAs for that stop
+		double cert = 0;
+		etas.clear ();
+		for (auto& p: particles) {
+			if (p.get_etas ().size () != stops.size () ||
+				p.get_eta (j) == 0 ||
+				p.is_finished ()) continue;
+			etas.push_back (p.get_eta (j));
+			cert += p.get_cert (j);
+		}
+		if (etas.size () == 0) continue;
+		cert /= etas.size ();
+		// select the percentiles: 0.025, 0.5, 0.975
+		sampling::quantiles (etas, probs, q);
+
+		transit_etas::Trip::ETA* tripetas = trip->add_etas ();
+		tripetas->set_stop_sequence (j+1);
+		tripetas->set_stop_id (stops[j].stop->get_id ());
+		tripetas->set_arrival_min (q[0]);
+		tripetas->set_arrival_max (q[2]);
+		tripetas->set_arrival_eta (q[1]);
+		tripetas->set_certainty (cert);
+	}
+}
+
+/**
+ * Decide how to divide the particle filter between the cores.
+ *
+ * With at least as many active vehicles as cores, each core updates
+ * whole vehicles; with fewer (e.g., off-peak), the cores would sit idle,
+ * so instead the vehicles are updated in turn, sharing each vehicle's
+ * particles between the cores.
+ *
+ * @param vs      reference to vector of vehicle pointers
+ * @param numcore the number of cores
+ * @return        true if particles should be split between cores
+ */
+bool split_vehicles (std::unordered_map<std::string, std::unique_ptr<gtfs::Vehicle> > &vs,
+					 int numcore) {
+	if (numcore <= 1) return false;
+	int nactive = 0;
+	for (auto& v: vs) {
+		if (v.second->get_trip () && !v.second->is_finished ()) nactive++;
+	}
+	return nactive < numcore;
+}
+
 /**
  * Start timer.
  * @param clock a CPU clock
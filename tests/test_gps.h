@@ -38,4 +38,34 @@ public:
 		TS_ASSERT_EQUALS(round(p3.crossTrackDistanceTo(p1, p2) * 1000), 5021);
 		TS_ASSERT_EQUALS(round(p3.alongTrackDistance(p1, p2) * 1000), 49037);
 	};
+
+	void testProjection(void) {
+		gps::Projection proj (p1);
+		double x, y;
+		proj.project (p1, x, y);
+		TS_ASSERT_EQUALS(x, 0);
+		TS_ASSERT_EQUALS(y, 0);
+
+		proj.project (p2, x, y);
+		std::vector<double> z (p2.projectFlat (p1));
+		TS_ASSERT_DELTA(x, z[0], 1e-6);
+		TS_ASSERT_DELTA(y, z[1], 1e-6);
+		TS_ASSERT_EQUALS(proj.unproject (x, y), p2);
+	};
+
+	void testGrid(void) {
+		std::vector<gps::Coord> path {p1, p2, p2.destinationPoint (1000, 0)};
+		gps::Grid grid (path, 40);
+		std::vector<unsigned> legs;
+
+		grid.query (p3, 10, legs);
+		TS_ASSERT_EQUALS(legs.size (), 1);
+		TS_ASSERT_EQUALS(legs[0], 0);
+
+		grid.query (p2.destinationPoint (500, 90), 100, legs);
+		TS_ASSERT_EQUALS(legs.size (), 0);
+		grid.query (p2.destinationPoint (500, 0), 10, legs);
+		TS_ASSERT_EQUALS(legs.size (), 1);
+		TS_ASSERT_EQUALS(legs[0], 1);
+	};
 };
@@ -3,6 +3,11 @@
 #include <math.h>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sqlite3.h>
 #include "gtfs.h"
 
 class VehicleTests : public CxxTest::TestSuite {
@@ -28,5 +33,501 @@ public:
 		vr.n_particles = 10;
 		vr.resample (rng);
 		TS_ASSERT_EQUALS (vr.get_particles ().size (), 10);
+		// again, reusing the previous generation's storage
+		vr.resample (rng);
+		vr.resample (rng);
+		TS_ASSERT_EQUALS (vr.get_particles ().size (), 10);
+		for (auto& p: vr.get_particles ()) {
+			TS_ASSERT (p.has_parent ());
+			TS_ASSERT (p.get_id () > p.get_parent_id ());
+		}
+	};
+	void testReset (void) {
+		gtfs::Vehicle w ("testbus3", 10);
+		auto id = w.get_particles ().back ().get_id ();
+		w.reset ();
+		TS_ASSERT_EQUALS (w.get_particles ().size (), 10);
+		TS_ASSERT_EQUALS (w.get_particles ().front ().get_id (), id + 1);
+		TS_ASSERT (!w.get_particles ().front ().has_parent ());
+		w.n_particles = 4;
+		w.reset ();
+		TS_ASSERT_EQUALS (w.get_particles ().size (), 4);
+		w.n_particles = 12;
+		w.reset ();
+		TS_ASSERT_EQUALS (w.get_particles ().size (), 12);
+		// growing keeps the order and IDs of a fresh set
+		auto& ps = w.get_particles ();
+		for (unsigned i=0; i<ps.size (); i++) {
+			TS_ASSERT_EQUALS (ps[i].get_id (), ps[0].get_id () + i);
+			TS_ASSERT (!ps[i].has_parent ());
+		}
+	};
+	void testLikelihoods (void) {
+		// without a trip, no particle can explain the observation
+		gtfs::Vehicle w ("testbus2", 5);
+		w.calculate_likelihoods (1);
+		TS_ASSERT_EQUALS (w.get_store ().size (), 5);
+		for (auto& p: w.get_particles ())
+			TS_ASSERT_EQUALS (p.get_likelihood (), -INFINITY);
+		// ... so they are all equally weighted
+		TS_ASSERT_DELTA (w.calculate_weights (), 5.0, 1e-12);
+		for (auto& wt: w.get_store ().weight) TS_ASSERT_DELTA (wt, 0.2, 1e-12);
+
+		// weights are relative: large negative likelihoods don't underflow
+		auto& ps = w.get_particles ();
+		for (unsigned i=0; i<ps.size (); i++) ps[i].set_likelihood (-2000.0 - i);
+		double Neff = w.calculate_weights ();
+		TS_ASSERT (Neff > 2.0 && Neff < 2.5);
+		TS_ASSERT_DELTA (w.get_store ().weight[0] / w.get_store ().weight[1], exp (1.0), 1e-9);
+	};
+	void testSpeedPrior (void) {
+		gtfs::Vehicle w ("testbus4", 1);
+		w.rao_blackwell = true;
+		gtfs::Particle& p = w.get_particles ()[0];
+		std::shared_ptr<gtfs::Intersection> none;
+		std::shared_ptr<gtfs::Segment> sg (new gtfs::Segment (1, none, none, 500.0));
+		gtfs::ShapeSegment ss (sg, 0.0);
+		// no estimate yet: unchanged
+		p.set_speed_prior (ss);
+		TS_ASSERT_EQUALS (p.get_speed_mean (), 0.0);
+		// travel time 50 +/- 50 seconds
+		sg->predict (1);
+		p.set_speed_prior (ss);
+		TS_ASSERT_DELTA (p.get_speed_mean (), 10.0, 1e-9);
+		TS_ASSERT_DELTA (p.get_speed_var (), 100.0, 1e-9);
+		TS_ASSERT_EQUALS (p.get_position_var (), 0.0);
+	};
+	void testStationary (void) {
+		// an empty database, with a unique name, removed however the test ends
+		const char* tmp = getenv ("TMPDIR");
+		std::string db = std::string (tmp ? tmp : "/tmp") + "/test_stationary_XXXXXX";
+		int fd = mkstemp (&db[0]);
+		TS_ASSERT (fd >= 0);
+		if (fd < 0) return;
+		close (fd);
+		struct Remove {
+			std::string file;
+			~Remove () { std::remove (file.c_str ()); }
+		} cleanup {db};
+		sqlite3* conn;
+		sqlite3_open (db.c_str (), &conn);
+		sqlite3_exec (conn, "CREATE TABLE IF NOT EXISTS stops (stop_id, lat, lng);"
+			"CREATE TABLE IF NOT EXISTS intersections (intersection_id, type, lat, lng);"
+			"CREATE TABLE IF NOT EXISTS segments (segment_id, from_id, to_id, start_at, end_at, length);",
+			0, 0, 0);
+		sqlite3_close (conn);
+		gtfs::GTFS g (db);
+
+		gtfs::Vehicle w ("testbus5", 1);
+		gps::Coord pos (-36.866580, 174.757195);
+		std::vector<double> moved {0, 5, 30, 100};
+		std::vector<bool> stationary {false, true, false, false};
+		for (unsigned k=0; k<moved.size (); k++) {
+			auto p = pos.destinationPoint (moved[k], 90);
+			transit_realtime::VehiclePosition vp;
+			vp.mutable_position ()->set_latitude (p.lat);
+			vp.mutable_position ()->set_longitude (p.lng);
+			vp.set_timestamp (100 + 30 * k);
+			w.update (vp, g);
+			TS_ASSERT_EQUALS (w.is_stationary (), stationary[k]);
+			if (k == 2) TS_ASSERT_DELTA (w.get_dmaxtraveled (), 30.0, 0.5);
+			pos = p;
+		}
+		TS_ASSERT_EQUALS (w.get_dmaxtraveled (), -1.0);
+	};
+};
+
+class TrajectoryTests : public CxxTest::TestSuite {
+public:
+	void testWindow (void) {
+		gtfs::Trajectory tr (5);
+		for (int k=0; k<3; k++) tr.push_back (k * 10.0);
+		TS_ASSERT_EQUALS (tr.size (), 3);
+		TS_ASSERT_EQUALS (tr.get_first (), 0);
+		TS_ASSERT_EQUALS (tr[1], 10.0);
+
+		// older values are discarded, but indices are unchanged
+		for (int k=3; k<12; k++) tr.push_back (k * 10.0);
+		TS_ASSERT_EQUALS (tr.size (), 12);
+		TS_ASSERT_EQUALS (tr.get_first (), 7);
+		TS_ASSERT_EQUALS (tr[7], 70.0);
+		TS_ASSERT_EQUALS (tr.back (), 110.0);
+		TS_ASSERT_EQUALS (tr.get_values ().size (), 5);
+
+		// truncate, then continue
+		tr.resize (9);
+		TS_ASSERT_EQUALS (tr.back (), 80.0);
+		tr.push_back (1.0);
+		TS_ASSERT_EQUALS (tr.size (), 10);
+		TS_ASSERT_EQUALS (tr[9], 1.0);
+		TS_ASSERT_EQUALS (tr[8], 80.0);
+		// waiting: many seconds at once
+		tr.push_back (5.0, 3);
+		TS_ASSERT_EQUALS (tr.size (), 13);
+		TS_ASSERT_EQUALS (tr[12], 5.0);
+		TS_ASSERT_EQUALS (tr[9], 1.0);
+		tr.push_back (7.0, 100);
+		TS_ASSERT_EQUALS (tr.size (), 113);
+		TS_ASSERT_EQUALS (tr.get_first (), 108);
+		TS_ASSERT_EQUALS (tr[108], 7.0);
+		tr.push_back (8.0);
+		TS_ASSERT_EQUALS (tr.get_first (), 109);
+		TS_ASSERT_EQUALS (tr.back (), 8.0);
+	};
+	void testBreakpoints (void) {
+		gtfs::Trajectory tr (300);
+		// moving seconds are merged
+		for (int k=0; k<100; k++) tr.push_back (k * 7.0 + (k % 2));
+		TS_ASSERT_EQUALS (tr.get_breakpoints (), 2);
+		TS_ASSERT_EQUALS (tr.back (), 99 * 7.0 + 1);
+		TS_ASSERT_EQUALS (tr[98], 98 * 7.0);
+		TS_ASSERT_DELTA (tr[50], 350.0, 1.0);
+		// waiting is kept
+		tr.push_back (tr.back (), 20);
+		TS_ASSERT_EQUALS (tr.size (), 120);
+		TS_ASSERT_EQUALS (tr[99], tr[119]);
+		// the kept seconds are exact
+		tr.keep (150);
+		for (int k=120; k<200; k++) tr.push_back (1000.0 + k * 3.0 + (k % 2));
+		TS_ASSERT_EQUALS (tr[149], 1000.0 + 149 * 3.0 + 1);
+		TS_ASSERT_EQUALS (tr[150], 1000.0 + 150 * 3.0);
+		TS_ASSERT (tr.get_breakpoints () < 10);
+		tr.set (150, 1500.0);
+		TS_ASSERT_EQUALS (tr[150], 1500.0);
+		tr.resize (151);
+		TS_ASSERT_EQUALS (tr.back (), 1500.0);
+		TS_ASSERT_EQUALS (tr[149], 1000.0 + 149 * 3.0 + 1);
+	};
+};
+
+class StopTimeTests : public CxxTest::TestSuite {
+public:
+	void testParseTime (void) {
+		TS_ASSERT_EQUALS (gtfs::parse_time ("00:00:00"), 0);
+		TS_ASSERT_EQUALS (gtfs::parse_time ("08:30:15"), 30615);
+		TS_ASSERT_EQUALS (gtfs::parse_time (" 8:30:15"), 30615);
+		TS_ASSERT_EQUALS (gtfs::parse_time ("25:10:00"), 90600);
+		TS_ASSERT_EQUALS (gtfs::parse_time ("8:3:15"), -1);
+		TS_ASSERT_EQUALS (gtfs::parse_time ("08:61:00"), -1);
+		TS_ASSERT_EQUALS (gtfs::parse_time (""), -1);
+		TS_ASSERT_EQUALS (gtfs::parse_time (nullptr), -1);
+	};
+};
+
+class ShapeIndexTests : public CxxTest::TestSuite {
+public:
+	std::vector<gtfs::ShapePt> path {
+		gtfs::ShapePt (gps::Coord (-36.866580, 174.757195), 0.0),
+		gtfs::ShapePt (gps::Coord (-36.866183, 174.757773), 67.769),
+		gtfs::ShapePt (gps::Coord (-36.865500, 174.758000), 146.0)
+	};
+	gtfs::ShapeIndex index = gtfs::ShapeIndex (path);
+
+	void testFind (void) {
+		TS_ASSERT_EQUALS (index.size (), 3);
+		TS_ASSERT_EQUALS (index.find (-10), 0);
+		TS_ASSERT_EQUALS (index.find (30), 0);
+		TS_ASSERT_EQUALS (index.find (67.769), 1);
+		TS_ASSERT_EQUALS (index.find (500), 1);
+	};
+
+	void testCoords (void) {
+		TS_ASSERT_EQUALS (index.get_coords (0), path[0].pt);
+		TS_ASSERT_EQUALS (index.get_coords (146.0), path[2].pt);
+		TS_ASSERT_EQUALS (index.get_coords (1000), path[2].pt);
+
+		auto p = path[0].pt.destinationPoint (30, path[0].pt.bearingTo (path[1].pt));
+		TS_ASSERT_LESS_THAN (index.get_coords (30).distanceTo (p), 0.01);
+	};
+
+	void testBatchCoords (void) {
+		std::vector<double> ds {0, 30, 67.769, 100, 200};
+		std::vector<gps::Coord> xs;
+		index.get_coords (ds, xs);
+		TS_ASSERT_EQUALS (xs.size (), ds.size ());
+		for (unsigned i=0; i<ds.size (); i++)
+			TS_ASSERT_EQUALS (xs[i], index.get_coords (ds[i]));
+	};
+
+	void testDirection (void) {
+		double px, py, tx, ty, qx, qy;
+		index.project (30, px, py, tx, ty);
+		index.project (30, qx, qy);
+		TS_ASSERT_EQUALS (px, qx);
+		TS_ASSERT_EQUALS (py, qy);
+		TS_ASSERT_DELTA (tx * tx + ty * ty, 1.0, 1e-12);
+		// heading north-east
+		TS_ASSERT (tx > 0 && ty > 0);
+	};
+
+	void testSnap (void) {
+		auto p = index.get_coords (100);
+		TS_ASSERT_DELTA (index.snap (p, 20), 100, 0.01);
+		TS_ASSERT_DELTA (index.snap (p.destinationPoint (5, 270), 20), 100, 5);
+		TS_ASSERT_EQUALS (index.snap (p.destinationPoint (500, 270), 20), -1);
+
+		std::vector<unsigned> legs;
+		index.near (p, 20, legs);
+		TS_ASSERT (std::find (legs.begin (), legs.end (), 1) != legs.end ());
+		index.near (p.destinationPoint (500, 270), 20, legs);
+		TS_ASSERT_EQUALS (legs.size (), 0);
+	};
+};
+
+class SegmentTests : public CxxTest::TestSuite {
+public:
+	void testPredict (void) {
+		std::shared_ptr<gtfs::Intersection> none;
+		gtfs::Segment sg (1, none, none, 500.0);
+		sg.predict (100);
+		TS_ASSERT_EQUALS (sg.get_travel_time (), 50.0);
+		TS_ASSERT_EQUALS (sg.get_travel_time_var (), 2500.0);
+		sg.add_data (80, 25.0);
+		sg.update ();
+		double tt = sg.get_travel_time (), var = sg.get_travel_time_var ();
+
+		// one step per second
+		double psi = 0.001 * var / (var + 2500.0);
+		for (int i=0; i<600; i++) tt += psi * (50.0 - tt);
+		double F = pow (1 - psi, 600);
+		var = F * F * var + 2500.0 * (1 - F * F);
+
+		sg.predict (700);
+		TS_ASSERT_DELTA (sg.get_travel_time (), tt, 1e-9);
+		TS_ASSERT_DELTA (sg.get_travel_time_var (), var, 1e-9);
+		TS_ASSERT_EQUALS (sg.get_timestamp (), 700);
+		// predicting to the past does nothing
+		sg.predict (600);
+		TS_ASSERT_DELTA (sg.get_travel_time (), tt, 1e-9);
+		TS_ASSERT_EQUALS (sg.get_timestamp (), 700);
+	};
+
+	void testCatchUp (void) {
+		std::shared_ptr<gtfs::Intersection> none;
+		gtfs::Segment sg (1, none, none, 500.0), ref (2, none, none, 500.0);
+		uint64_t now = 0;
+		sg.set_clock (&now);
+		TS_ASSERT (!sg.is_initialized ());
+		now = 100;
+		// reading initialises the segment at the clock's time
+		TS_ASSERT (sg.is_initialized ());
+		TS_ASSERT_EQUALS (sg.get_timestamp (), 100);
+		ref.predict (100);
+		sg.add_data (80, 25.0);
+		ref.add_data (80, 25.0);
+		now = 400;
+		// updating predicts first
+		sg.update ();
+		ref.predict (400);
+		ref.update ();
+		TS_ASSERT_DELTA (sg.get_travel_time (), ref.get_travel_time (), 1e-9);
+		now = 700;
+		ref.predict (700);
+		TS_ASSERT_DELTA (sg.get_travel_time (), ref.get_travel_time (), 1e-9);
+		TS_ASSERT_DELTA (sg.get_travel_time_var (), ref.get_travel_time_var (), 1e-9);
+		TS_ASSERT_EQUALS (sg.get_timestamp (), 700);
+	};
+
+	void testData (void) {
+		std::shared_ptr<gtfs::Intersection> none;
+		gtfs::Segment sg (1, none, none, 500.0);
+		double mean, var;
+		TS_ASSERT (!sg.has_data ());
+		TS_ASSERT (!sg.take_data (mean, var));
+
+		// vehicles add their travel times at the same time
+		#pragma omp parallel for num_threads(4)
+		for (int i=0; i<1000; i++) sg.add_data (40 + i % 20, i % 2 ? 9.0 : 0.0);
+		TS_ASSERT (sg.has_data ());
+		TS_ASSERT (sg.take_data (mean, var));
+		// mean of 40..59; their variance, plus the mean of 9 and 100 (for 0)
+		TS_ASSERT_DELTA (mean, 49.5, 1e-9);
+		TS_ASSERT_DELTA (var, (400.0 - 1) / 12 + 54.5, 1e-9);
+		TS_ASSERT (!sg.has_data ());
+		TS_ASSERT (!sg.take_data (mean, var));
+	};
+
+	void testNetwork (void) {
+		std::shared_ptr<gtfs::Intersection> none;
+		std::vector<std::shared_ptr<gtfs::Segment> > sg;
+		for (int i=0; i<4; i++) {
+			sg.push_back (std::make_shared<gtfs::Segment> (i + 1, none, none, 500.0));
+			sg.back ()->predict (100);
+		}
+		gtfs::Segment ref (9, none, none, 500.0);
+		ref.predict (100);
+
+		// independent: the usual Kalman filter update, neighbours untouched
+		gtfs::SegmentNetwork net;
+		net.correlation = 0;
+		for (int i=0; i<3; i++) net.link (sg[i], sg[i+1]);
+		TS_ASSERT_EQUALS (net.size (), 4);
+		sg[1]->add_data (80, 25.0);
+		ref.add_data (80, 25.0);
+		TS_ASSERT_EQUALS (net.update (), 1);
+		ref.update ();
+		TS_ASSERT_DELTA (sg[1]->get_travel_time (), ref.get_travel_time (), 1e-9);
+		TS_ASSERT_DELTA (sg[1]->get_travel_time_var (), ref.get_travel_time_var (), 1e-9);
+		TS_ASSERT_EQUALS (sg[0]->get_travel_time (), 50.0);
+		TS_ASSERT (!sg[1]->has_data ());
+		TS_ASSERT_EQUALS (net.update (), 0);
+
+		// an observation without variance
+		gtfs::Segment ref0 (10, none, none, 500.0);
+		ref0.predict (100);
+		sg[3]->add_data (80, 0.0);
+		ref0.add_data (80, 0.0);
+		TS_ASSERT_EQUALS (net.update (), 1);
+		ref0.update ();
+		TS_ASSERT_DELTA (sg[3]->get_travel_time (), ref0.get_travel_time (), 1e-9);
+		TS_ASSERT_DELTA (sg[3]->get_travel_time_var (), ref0.get_travel_time_var (), 1e-9);
+
+		// a pair: the neighbour's error moves by rho times as much
+		double rho = 0.6;
+		std::vector<std::shared_ptr<gtfs::Segment> > pr;
+		for (int i=0; i<2; i++) {
+			pr.push_back (std::make_shared<gtfs::Segment> (i + 1, none, none, 500.0));
+			pr.back ()->predict (100);
+		}
+		gtfs::SegmentNetwork pair;
+		pair.correlation = rho;
+		pair.link (pr[0], pr[1]);
+		pr[1]->add_data (80, 25.0);
+		TS_ASSERT_EQUALS (pair.update (), 2);
+		double K = 2500.0 / (2500.0 + 25.0);
+		TS_ASSERT_DELTA (pr[1]->get_travel_time (), 50.0 + K * 30.0, 1e-6);
+		TS_ASSERT_DELTA (pr[1]->get_travel_time_var (), 2500.0 * (1 - K), 1e-6);
+		TS_ASSERT_DELTA (pr[0]->get_travel_time (), 50.0 + rho * K * 30.0, 1e-6);
+		TS_ASSERT_DELTA (pr[0]->get_travel_time_var (), 2500.0 * (1 - rho * rho * K), 1e-6);
+
+		// a chain: the update fades with distance, and stops after `hops`
+		net.correlation = rho;
+		net.hops = 1;
+		sg[0]->add_data (80, 25.0);
+		double t1 = sg[1]->get_travel_time (), t2 = sg[2]->get_travel_time ();
+		TS_ASSERT_EQUALS (net.update (), 2);
+		TS_ASSERT (sg[0]->get_travel_time () - 50.0 > sg[1]->get_travel_time () - t1);
+		TS_ASSERT (sg[1]->get_travel_time () > t1);
+		TS_ASSERT_EQUALS (sg[2]->get_travel_time (), t2);
+	};
+};
+
+/**
+ * A route with stops at 0, 400 and 900 m, and segments starting at 0, 250 and 400 m.
+ *
+ * @param  segs set to the route's segments
+ * @return      the route
+ */
+static std::shared_ptr<gtfs::Route> make_route (std::vector<gtfs::ShapeSegment>& segs) {
+	std::string id = "1", sid = "s";
+	gps::Coord pos (-36.866580, 174.757195);
+	auto stop = std::make_shared<gtfs::Stop> (sid, pos);
+	std::vector<gtfs::RouteStop> stops {
+		gtfs::RouteStop (stop, 0), gtfs::RouteStop (stop, 400), gtfs::RouteStop (stop, 900)
+	};
+	std::vector<gtfs::ShapePt> path;
+	std::shared_ptr<gtfs::Intersection> none;
+	std::vector<double> starts {0, 250, 400};
+	segs.clear ();
+	for (unsigned l=0; l<3; l++) {
+		double len = (l < 2 ? starts[l+1] : 900) - starts[l];
+		segs.emplace_back (std::make_shared<gtfs::Segment> (l+1, none, none, len), starts[l]);
+	}
+	auto shape = std::make_shared<gtfs::Shape> (id, path, segs);
+	auto route = std::make_shared<gtfs::Route> (id, id, id, shape);
+	route->add_stops (stops);
+	return route;
+};
+
+class RouteEventTests : public CxxTest::TestSuite {
+public:
+	void testEvents (void) {
+		std::vector<gtfs::ShapeSegment> segs;
+		auto routep = make_route (segs);
+		gtfs::Route& route = *routep;
+
+		auto& events = route.get_events ();
+		TS_ASSERT_EQUALS (events.size (), 4);
+		// intersection at 250, then the stop and intersection at 400 (stop first)
+		TS_ASSERT (!events[0].is_stop ());
+		TS_ASSERT_EQUALS (events[0].segment, 1);
+		TS_ASSERT_EQUALS (events[0].stop, 0);
+		TS_ASSERT (events[1].is_stop ());
+		TS_ASSERT_EQUALS (events[1].stop, 1);
+		TS_ASSERT_EQUALS (events[1].segment, 1);
+		TS_ASSERT (!events[2].is_stop ());
+		TS_ASSERT_EQUALS (events[2].segment, 2);
+		TS_ASSERT_EQUALS (events[3].stop, 2);
+
+		TS_ASSERT_EQUALS (route.find_event (0), 0);
+		TS_ASSERT_EQUALS (route.find_event (300), 1);
+		TS_ASSERT_EQUALS (route.find_event (400), 1);
+		TS_ASSERT_EQUALS (route.find_event (1000), 4);
+	};
+};
+
+class RouteTimingTests : public CxxTest::TestSuite {
+public:
+	std::vector<gtfs::ShapeSegment> segs;
+	std::shared_ptr<gtfs::Route> route;
+
+	void setUp (void) {
+		route = make_route (segs);
+	};
+
+	void testSegmentSpeeds (void) {
+		sampling::RNG rng (1);
+		gtfs::SegmentSpeeds sp;
+		TS_ASSERT (sp.draw (*route, 1, 10, rng));
+		TS_ASSERT_EQUALS (sp.length[2], 500);
+		for (unsigned r=0; r<10; r++) {
+			TS_ASSERT (sp.get_speed (r, 1) > 0 && sp.get_speed (r, 1) <= 30);
+			TS_ASSERT_EQUALS (sp.get_speed (r, 0), 0);
+		}
+		// unchanged segments keep their speeds
+		double v = sp.get_speed (3, 2);
+		TS_ASSERT (!sp.draw (*route, 2, 10, rng));
+		// ... until their estimate changes
+		segs[2].segment->predict (1);
+		TS_ASSERT (sp.draw (*route, 2, 10, rng));
+		TS_ASSERT_DIFFERS (sp.get_speed (3, 2), v);
+		// only segment 2 has an estimate
+		TS_ASSERT_EQUALS (sp.get_cert (3, 1), 0);
+		TS_ASSERT_EQUALS (sp.get_cert (3, 2), 1);
+	};
+
+	void testRouteTimes (void) {
+		gtfs::RouteTimes rt;
+		TS_ASSERT (rt.update (*route));
+		TS_ASSERT (!rt.update (*route));
+		double m, v;
+		// within a segment, without estimates: 15 m/s
+		rt.travel_time (50, 200, m, v);
+		TS_ASSERT_DELTA (m, 10.0, 1e-9);
+		TS_ASSERT_DELTA (v, pow (0.6, 2) * pow (250.0 / 225, 2) * 25, 1e-9);
+		TS_ASSERT_EQUALS (rt.get_cert (200), 0);
+
+		// the whole route, including the time at the stop and intersections in between
+		auto& events = route->get_events ();
+		double wait = 0;
+		for (auto& ev: events) {
+			if (ev.distance > 0 && ev.distance < 900) wait += ev.pstop * (ev.wait_min + ev.wait_mean);
+		}
+		rt.travel_time (0, 900, m, v);
+		TS_ASSERT_DELTA (m, 60.0 + wait, 1e-9);
+		// ... adds up
+		double m1, v1, m2, v2;
+		rt.travel_time (0, 300, m1, v1);
+		rt.travel_time (300, 900, m2, v2);
+		TS_ASSERT_DELTA (m1 + m2, m, 1e-9);
+
+		// segments with estimates replace the prior
+		segs[2].segment->predict (1);
+		TS_ASSERT (rt.update (*route));
+		rt.travel_time (650, 900, m, v);
+		TS_ASSERT_DELTA (m, 0.5 * segs[2].segment->get_travel_time (), 1e-9);
+		TS_ASSERT_DELTA (v, 0.25 * segs[2].segment->get_travel_time_var (), 1e-9);
+		TS_ASSERT_EQUALS (rt.get_cert (900), 1);
+		TS_ASSERT_EQUALS (rt.get_cert (400), 0);
 	};
 };
@@ -1,5 +1,7 @@
 #include <cxxtest/TestSuite.h>
 #include <time.h>
+#include <algorithm>
+#include <vector>
 
 #include <sampling.h>
 
@@ -20,6 +22,31 @@ public:
 		TS_ASSERT_DIFFERS(u1, u3);
 	};
 
+	void testBlocks(void) {
+		// single draws come from the same stream as blocks
+		std::vector<double> x (300);
+		rng.set_seed (10);
+		rng.runif (x.data (), x.size ());
+		rng.set_seed (10);
+		for (int i=0; i<300; i++) TS_ASSERT_EQUALS (rng.runif (), x[i]);
+
+		int n = 100000;
+		std::vector<double> u (n), z (n), e (n);
+		rng.runif (u.data (), n);
+		rng.rnorm (z.data (), n);
+		rng.rexp (e.data (), n);
+		double zbar = 0.0, z2 = 0.0, ebar = 0.0;
+		for (int i=0; i<n; i++) {
+			TS_ASSERT (u[i] > 0 && u[i] < 1);
+			zbar += z[i];
+			z2 += z[i] * z[i];
+			ebar += e[i];
+		}
+		TS_ASSERT_DELTA (zbar / n, 0.0, 0.02);
+		TS_ASSERT_DELTA (z2 / n, 1.0, 0.02);
+		TS_ASSERT_DELTA (ebar / n, 1.0, 0.02);
+	};
+
 	void testUniform(void) {
 		rng.set_seed (time(NULL));
 
@@ -77,6 +104,37 @@ public:
 	};
 
 
+	void testTruncatedNormal(void) {
+		rng.set_seed (time(NULL) + 5);
+
+		TS_ASSERT_THROWS (sampling::truncated_normal tn (0, 0, 0, 1), std::invalid_argument);
+		TS_ASSERT_THROWS (sampling::truncated_normal tn (0, 1, 1, 0), std::invalid_argument);
+
+		for (double x: {-9.0, -3.0, -0.5, 0.0, 1.0, 4.0})
+			TS_ASSERT_DELTA (sampling::qnorm (sampling::pnorm (x)), x, 1e-9);
+
+		// an interval in the upper tail: mean is mu + sigma * phi(alpha) / (1 - Phi(alpha))
+		sampling::truncated_normal tn (0, 1, 3, INFINITY);
+		TS_ASSERT (tn.quantile (0.2) < tn.quantile (0.8));
+		int n = 100000;
+		std::vector<double> x (n);
+		tn.rand (rng, x.data (), n);
+		double xbar = 0.0;
+		for (auto& xi: x) {
+			TS_ASSERT (xi >= 3);
+			xbar += xi;
+		}
+		double mean = exp (-4.5) / sqrt (2 * M_PI) / (1 - sampling::pnorm (3));
+		TS_ASSERT_DELTA (xbar / n, mean, 0.01);
+
+		sampling::truncated_normal tn2 (10, 12, 0, 3);
+		for (int i=0; i<100; i++) {
+			double v = tn2.rand (rng);
+			TS_ASSERT (v >= 0 && v <= 3);
+		}
+		TS_ASSERT_EQUALS (round (tn2.pdf (-1)), 0);
+	};
+
 	void testSample(void) {
 		rng.set_seed (time(NULL) + 3);
 
@@ -105,4 +163,64 @@ public:
 		TS_ASSERT_EQUALS (smp_wt3.get (rng)[0], 2);
 
 	};
+
+	void testSchemes(void) {
+		rng.set_seed (time(NULL) + 4);
+
+		TS_ASSERT_EQUALS (sampling::get_scheme ("residual"), sampling::residual);
+		TS_ASSERT_THROWS (sampling::get_scheme ("bogus"), std::invalid_argument);
+
+		sampling::sample smp ({0.0, 0.5, 0.0, 0.5});
+		for (auto type: {sampling::multinomial, sampling::systematic,
+		                 sampling::stratified, sampling::residual}) {
+			auto s = smp.get (10, rng, type);
+			TS_ASSERT_EQUALS (s.size (), 10);
+			for (auto& i: s) TS_ASSERT (i == 1 || i == 3);
+		}
+
+		// systematic and residual reproduce exact proportions
+		for (auto type: {sampling::systematic, sampling::residual}) {
+			auto s = smp.get (10, rng, type);
+			TS_ASSERT_EQUALS (std::count (s.begin (), s.end (), 1), 5);
+		}
+
+		// residual: floor(n*w) copies guaranteed
+		sampling::sample smp2 ({0.75, 0.25});
+		auto s = smp2.get (5, rng, sampling::residual);
+		TS_ASSERT (std::count (s.begin (), s.end (), 0) >= 3);
+		TS_ASSERT (std::count (s.begin (), s.end (), 1) >= 1);
+
+		// unweighted
+		sampling::sample smp3 (4);
+		s = smp3.get (8, rng, sampling::systematic);
+		for (int i=0; i<4; i++) TS_ASSERT_EQUALS (std::count (s.begin (), s.end (), i), 2);
+	};
+
+	void testQuantiles(void) {
+		rng.set_seed (time(NULL) + 5);
+
+		std::vector<double> p {0.025, 0.5, 0.5, 0.975, 1.0};
+		std::vector<uint64_t> q;
+		for (int n: {1, 2, 7, 40, 1000}) {
+			std::vector<uint64_t> x (n);
+			for (auto& xi: x) xi = 1500000000 + (uint64_t)(rng.runif () * 600);
+			std::vector<uint64_t> y (x);
+			std::sort (y.begin (), y.end ());
+			sampling::quantiles (x, p, q);
+			TS_ASSERT_EQUALS (q.size (), p.size ());
+			for (unsigned i=0; i<4; i++) TS_ASSERT_EQUALS (q[i], y[(int)(n * p[i])]);
+			TS_ASSERT_EQUALS (q[4], y.back ());
+		}
+
+		std::vector<double> xd {0.5, -1.0, 2.5, 1.0}, qd;
+		sampling::quantiles (xd, {0.0, 0.5, 0.99}, qd);
+		TS_ASSERT_EQUALS (qd[0], -1.0);
+		TS_ASSERT_EQUALS (qd[1], 1.0);
+		TS_ASSERT_EQUALS (qd[2], 2.5);
+
+		std::vector<uint64_t> x {3, 1, 2};
+		TS_ASSERT_THROWS (sampling::quantiles (x, {0.5, 0.1}, q), std::invalid_argument);
+		x.clear ();
+		TS_ASSERT_THROWS (sampling::quantiles (x, p, q), std::invalid_argument);
+	};
 };